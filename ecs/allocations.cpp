@@ -0,0 +1,108 @@
+#include "allocations.hpp"
+
+#if defined(ECS_TRACK_ALLOCATIONS)
+
+#include <new>
+#include <cstdlib>
+
+namespace ecs {
+
+namespace {
+    thread_local AllocationCounters* currentCounters = nullptr;
+
+    void track(std::size_t size) {
+        if(!currentCounters) return;
+        currentCounters->count.fetch_add(1, std::memory_order_relaxed);
+        currentCounters->bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    // Like the standard operator new: if allocating fails, the new handler may free some memory (then it's tried
+    // again), throw or terminate. Only without one bad_alloc is thrown.
+    template <typename Alloc>
+    void* allocateOrThrow(std::size_t size, Alloc&& alloc) {
+        track(size);
+        while(true) {
+            if(auto pointer = alloc()) return pointer;
+            const auto handler = std::get_new_handler();
+            if(!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* allocate(std::size_t size) {
+        return allocateOrThrow(size, [size]() { return std::malloc(size > 0 ? size : 1); });
+    }
+
+    void* allocateAligned(std::size_t size, std::align_val_t alignment) {
+        const auto align = static_cast<std::size_t>(alignment);
+        return allocateOrThrow(size, [size, align]() {
+#if defined(_WIN32)
+            return _aligned_malloc(size > 0 ? size : 1, align);
+#else
+            // aligned_alloc wants a multiple of the alignment
+            return std::aligned_alloc(align, (size + align - 1) / align * align + (size == 0 ? align : 0));
+#endif
+        });
+    }
+
+    void* allocateNothrow(std::size_t size) noexcept {
+        try {
+            return allocate(size);
+        } catch(const std::bad_alloc&) {
+            return nullptr;
+        }
+    }
+
+    void freeAligned(void* pointer) {
+#if defined(_WIN32)
+        _aligned_free(pointer);
+#else
+        std::free(pointer);
+#endif
+    }
+}
+
+AllocationScope::AllocationScope(AllocationCounters* counters) : mPrevious(currentCounters) {
+    currentCounters = counters;
+}
+
+AllocationScope::~AllocationScope() {
+    currentCounters = mPrevious;
+}
+
+} // namespace ecs
+
+void* operator new(std::size_t size) {
+    return ecs::allocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return ecs::allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return ecs::allocateNothrow(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return ecs::allocateNothrow(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return ecs::allocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return ecs::allocateAligned(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { ecs::freeAligned(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { ecs::freeAligned(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { ecs::freeAligned(pointer); }
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { ecs::freeAligned(pointer); }
+
+#endif
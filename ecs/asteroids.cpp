@@ -161,13 +161,20 @@ void lifetimeSystem(ecs::EntityHandle entity, float dt, CLifetime& lifetime) {
     if(lifetime.value < 0) entity.destroy();
 }
 
-void collisionDetectionSystem(ecs::EntityHandle entity, ecs::World& world, const CCollider& collider, const CTransform& transform) {
-    for(auto other : world.entitiesWith<const CCollider, const CTransform>()) {
-        if(entity == other) continue;
-        const auto rel = other.get<CTransform>().position - transform.position;
-        if(glm::length(rel) < collider.radius + other.get<CCollider>().radius) {
-            entity.get<ECollision, true>().emit(other.getId());
-        }
+void collisionDetectionSystem(ecs::World& world) {
+    using Collision = std::pair<ecs::EntityId, ecs::EntityId>;
+    const auto collisions = world.forEachPair<Collision>(ecs::With<const CCollider, const CTransform>(),
+        [](ecs::EntityHandle a, ecs::EntityHandle b, std::vector<Collision>& output) {
+            const auto rel = b.get<const CTransform>().position - a.get<const CTransform>().position;
+            if(glm::length(rel) < a.get<const CCollider>().radius + b.get<const CCollider>().radius) {
+                output.emplace_back(a.getId(), b.getId());
+            }
+        }, std::execution::par);
+
+    // adding the event components has to happen serially
+    for(const auto& [a, b] : collisions) {
+        world.getEntityHandle(a).get<ECollision, true>().emit(b);
+        world.getEntityHandle(b).get<ECollision, true>().emit(a);
     }
 }
 
@@ -321,7 +328,7 @@ int main(int argc, char** argv) {
         world.tickSystem<CVelocity, const CFriction>(false, true, frictionSystem, dt);
         world.tickSystem<CTransform, const CVelocity>(false, true, physicsIntegrationSystem, dt, winSizef);
         world.tickSystem<CLifetime>(false, false, lifetimeSystem, dt);
-        world.tickSystem<const CCollider, const CTransform>(false, false, collisionDetectionSystem, world);
+        collisionDetectionSystem(world);
         world.tickSystem<const CCollider, const CTransform, const CVelocity, ECollision>(false, false, collisionResolutionSystem, world);
 
         // Clear event components
@@ -0,0 +1,225 @@
+// Runs a few workloads with 1, 2, 4, ... threads and prints how well they scale.
+// Usage: benchmark [max threads] [frames]
+// The thread ticking the world processes chunks and jobs too, so n threads means a pool with n - 1 workers. With a
+// single thread the same systems run synchronously and without parallelFor instead, which is the baseline for the
+// speedup (T1 / Tn) and the efficiency (speedup / n).
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ecs.hpp"
+
+namespace {
+
+float randf(float min = 0.f, float max = 1.f) {
+    static std::default_random_engine engine;
+    static std::uniform_real_distribution<float> dist(0.f, 1.f);
+    return dist(engine) * (max - min) + min;
+}
+
+struct Vec2 {
+    float x, y;
+};
+
+// The components and systems of the asteroids example, without rendering and input
+struct CTransform {
+    Vec2 position;
+    float angle;
+};
+
+struct CVelocity {
+    Vec2 value;
+};
+
+struct CFriction {
+    float value;
+};
+
+struct CMaxSpeed {
+    float value;
+};
+
+struct CLifetime {
+    float value;
+};
+
+struct CCollider {
+    float radius;
+};
+
+void maxSpeedSystem(CVelocity& velocity, const CMaxSpeed& maxSpeed) {
+    const auto speed = std::sqrt(velocity.value.x * velocity.value.x + velocity.value.y * velocity.value.y);
+    if(speed > maxSpeed.value) {
+        velocity.value.x *= maxSpeed.value / speed;
+        velocity.value.y *= maxSpeed.value / speed;
+    }
+}
+
+void frictionSystem(float dt, CVelocity& velocity, const CFriction& friction) {
+    velocity.value.x -= velocity.value.x * friction.value * dt;
+    velocity.value.y -= velocity.value.y * friction.value * dt;
+}
+
+void physicsIntegrationSystem(float dt, const Vec2& size, CTransform& transform, const CVelocity& velocity) {
+    transform.position.x += velocity.value.x * dt;
+    transform.position.y += velocity.value.y * dt;
+    if(transform.position.x < 0) transform.position.x += size.x;
+    if(transform.position.y < 0) transform.position.y += size.y;
+    if(transform.position.x > size.x) transform.position.x -= size.x;
+    if(transform.position.y > size.y) transform.position.y -= size.y;
+}
+
+void lifetimeSystem(float dt, CLifetime& lifetime) {
+    lifetime.value -= dt;
+    if(lifetime.value < 0) lifetime.value += 2.f; // respawn, so the entity count stays the same
+}
+
+// Synthetic kernels
+struct CCompute {
+    float value;
+};
+
+struct CMemory {
+    float values[16]; // a cache line per entity
+};
+
+template <size_t index>
+struct CAsyncLane {
+    float value;
+};
+
+struct Workload {
+    std::string name;
+    size_t entities; // processed per frame, for the throughput
+    std::function<void(ecs::World&)> setup;
+    std::function<void(ecs::World&, bool parallel)> frame;
+};
+
+const Vec2 worldSize{4000.f, 4000.f};
+const float dt = 1.f / 60.f;
+
+std::vector<Workload> getWorkloads() {
+    std::vector<Workload> workloads;
+
+    const size_t asteroidCount = 500000, colliderCount = 2000;
+    workloads.push_back({"asteroids", asteroidCount, [=](ecs::World& world) {
+        for(size_t i = 0; i < asteroidCount; ++i) {
+            auto e = world.createEntity();
+            e.add<CTransform>(CTransform{{randf(0.f, worldSize.x), randf(0.f, worldSize.y)}, randf(0.f, 6.28f)});
+            e.add<CVelocity>(CVelocity{{randf(-300.f, 300.f), randf(-300.f, 300.f)}});
+            e.add<CFriction>(CFriction{0.4f});
+            e.add<CMaxSpeed>(CMaxSpeed{200.f});
+            e.add<CLifetime>(CLifetime{randf(0.f, 2.f)});
+            if(i < colliderCount) e.add<CCollider>(CCollider{randf(5.f, 40.f)});
+        }
+    }, [](ecs::World& world, bool parallel) {
+        world.tickSystem<CVelocity, const CMaxSpeed>(false, parallel, maxSpeedSystem);
+        world.tickSystem<CVelocity, const CFriction>(false, parallel, frictionSystem, dt);
+        world.tickSystem<CTransform, const CVelocity>(false, parallel, physicsIntegrationSystem, dt, worldSize);
+        world.tickSystem<CLifetime>(parallel, false, lifetimeSystem, dt);
+        using Collision = std::pair<ecs::EntityId, ecs::EntityId>;
+        auto collide = [](ecs::EntityHandle a, ecs::EntityHandle b, std::vector<Collision>& output) {
+            const auto& pa = a.get<const CTransform>().position, & pb = b.get<const CTransform>().position;
+            const auto dx = pb.x - pa.x, dy = pb.y - pa.y;
+            const auto radius = a.get<const CCollider>().radius + b.get<const CCollider>().radius;
+            if(dx * dx + dy * dy < radius * radius) output.emplace_back(a.getId(), b.getId());
+        };
+        if(parallel) {
+            world.forEachPair<Collision>(ecs::With<const CCollider, const CTransform>(), collide, std::execution::par);
+        } else {
+            world.forEachPair<Collision>(ecs::With<const CCollider, const CTransform>(), collide, std::execution::seq);
+        }
+        world.finishTick();
+    }});
+
+    const size_t computeCount = 200000;
+    workloads.push_back({"compute", computeCount, [=](ecs::World& world) {
+        for(size_t i = 0; i < computeCount; ++i) world.createEntity().add<CCompute>(CCompute{randf()});
+    }, [](ecs::World& world, bool parallel) {
+        world.tickSystem<CCompute>(false, parallel, [](CCompute& c) {
+            auto x = c.value;
+            for(int i = 0; i < 64; ++i) x = std::sin(x) * 0.5f + std::cos(x * 1.3f) * 0.5f;
+            c.value = x;
+        });
+        world.finishTick();
+    }});
+
+    const size_t memoryCount = 4000000;
+    workloads.push_back({"memory", memoryCount, [=](ecs::World& world) {
+        for(size_t i = 0; i < memoryCount; ++i) world.createEntity().add<CMemory>(CMemory{{randf()}});
+    }, [](ecs::World& world, bool parallel) {
+        world.tickSystem<CMemory>(false, parallel, [](CMemory& m) { m.values[0] += m.values[15] * 0.5f; m.values[15] = 1.f; });
+        world.finishTick();
+    }});
+
+    // independent asynchronous systems that don't use parallelFor, each runs as a single job on the worker pool,
+    // so this scales up to four threads
+    const size_t laneCount = 200000;
+    workloads.push_back({"async", laneCount * 4, [=](ecs::World& world) {
+        for(size_t i = 0; i < laneCount; ++i) {
+            auto e = world.createEntity();
+            e.add<CAsyncLane<0>>(CAsyncLane<0>{randf()});
+            e.add<CAsyncLane<1>>(CAsyncLane<1>{randf()});
+            e.add<CAsyncLane<2>>(CAsyncLane<2>{randf()});
+            e.add<CAsyncLane<3>>(CAsyncLane<3>{randf()});
+        }
+    }, [](ecs::World& world, bool parallel) {
+        auto lane = [](auto& c) {
+            auto x = c.value;
+            for(int i = 0; i < 16; ++i) x = std::sin(x) + 0.5f;
+            c.value = x;
+        };
+        world.tickSystem<CAsyncLane<0>>(parallel, false, lane);
+        world.tickSystem<CAsyncLane<1>>(parallel, false, lane);
+        world.tickSystem<CAsyncLane<2>>(parallel, false, lane);
+        world.tickSystem<CAsyncLane<3>>(parallel, false, lane);
+        world.finishTick();
+    }});
+
+    return workloads;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t maxThreads = argc > 1 ? std::max(1, std::atoi(argv[1])) : ecs::WorkerPool::defaultWorkerCount();
+    const size_t frames = argc > 2 ? std::max(1, std::atoi(argv[2])) : 50;
+
+    std::vector<size_t> threadCounts;
+    for(size_t threads = 1; threads < maxThreads; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    for(auto& workload : getWorkloads()) {
+        std::printf("%s (%zu entities, %zu frames)\n", workload.name.c_str(), workload.entities, frames);
+        std::printf("%8s %12s %14s %8s %10s %14s %14s\n", "threads", "ms/frame", "entities/s", "speedup",
+            "efficiency", "system wait ms", "mutex wait ms");
+        double baseline = 0.0;
+        for(const auto threads : threadCounts) {
+            // a pool needs at least one worker, but the single threaded run doesn't give it anything to do
+            const auto parallel = threads > 1;
+            ecs::World world(std::make_shared<ecs::WorkerPool>(parallel ? threads - 1 : 1));
+            workload.setup(world);
+            world.flush();
+            workload.frame(world, parallel); // warm up
+            world.resetWaitStats();
+
+            const auto start = std::chrono::steady_clock::now();
+            for(size_t frame = 0; frame < frames; ++frame) workload.frame(world, parallel);
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            const auto frameSeconds = seconds / frames;
+            if(threads == 1) baseline = frameSeconds; // always the first run
+            const auto speedup = baseline / frameSeconds;
+            const auto stats = world.getWaitStats();
+            std::printf("%8zu %12.3f %14.0f %8.2f %9.0f%% %14.3f %14.3f\n", threads, frameSeconds * 1e3,
+                workload.entities / frameSeconds, speedup, speedup / threads * 100.0,
+                stats.systemWaitSeconds * 1e3 / frames, stats.mutexWaitSeconds * 1e3 / frames);
+        }
+        std::printf("\n");
+    }
+    return 0;
+}
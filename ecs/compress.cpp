@@ -0,0 +1,105 @@
+#include "compress.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace ecs::lz {
+
+// Every sequence starts with a token with the number of literals in the high and the match length - MIN_MATCH in
+// the low nibble. A nibble of 15 is followed by extra bytes that are added to it until one is not 255.
+// Then come the literals, a 16 bit offset back into the output and the match. The last sequence only has literals.
+namespace {
+    const size_t MIN_MATCH = 4;
+    const size_t HASH_BITS = 12;
+    const size_t MAX_OFFSET = 65535;
+
+    uint32_t read32(const uint8_t* p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    uint8_t* writeLength(uint8_t* dst, size_t length) {
+        for(; length >= 255; length -= 255) *dst++ = 255;
+        *dst++ = static_cast<uint8_t>(length);
+        return dst;
+    }
+
+    uint8_t* writeSequence(uint8_t* dst, const uint8_t* literals, size_t literalCount, size_t offset, size_t matchLength) {
+        const auto matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+        *dst++ = static_cast<uint8_t>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15));
+        if(literalCount >= 15) dst = writeLength(dst, literalCount - 15);
+        std::memcpy(dst, literals, literalCount);
+        dst += literalCount;
+        if(matchLength == 0) return dst;
+        *dst++ = static_cast<uint8_t>(offset);
+        *dst++ = static_cast<uint8_t>(offset >> 8);
+        if(matchCode >= 15) dst = writeLength(dst, matchCode - 15);
+        return dst;
+    }
+
+    size_t readLength(const uint8_t*& src, size_t nibble) {
+        if(nibble < 15) return nibble;
+        uint8_t extra;
+        do {
+            extra = *src++;
+            nibble += extra;
+        } while(extra == 255);
+        return nibble;
+    }
+}
+
+size_t maxCompressedSize(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t compress(const uint8_t* src, size_t size, uint8_t* dst) {
+    // positions + 1 of the last occurence of a hash, 0 = none
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+    const auto dstBegin = dst;
+    size_t anchor = 0, pos = 0;
+    while(pos + MIN_MATCH <= size) {
+        const auto sequence = read32(src + pos);
+        const auto hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+        const auto candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(pos + 1);
+        if(candidate == 0 || pos - (candidate - 1) > MAX_OFFSET || read32(src + candidate - 1) != sequence) {
+            ++pos;
+            continue;
+        }
+        const auto matchPos = candidate - 1;
+        auto length = MIN_MATCH;
+        while(pos + length < size && src[matchPos + length] == src[pos + length]) ++length;
+        dst = writeSequence(dst, src + anchor, pos - anchor, pos - matchPos, length);
+        pos += length;
+        anchor = pos;
+    }
+    dst = writeSequence(dst, src + anchor, size - anchor, 0, 0);
+    return dst - dstBegin;
+}
+
+void decompress(const uint8_t* src, size_t compressedSize, uint8_t* dst, size_t size) {
+    const auto srcEnd = src + compressedSize;
+    size_t pos = 0;
+    while(true) {
+        const auto token = *src++;
+        const auto literalCount = readLength(src, token >> 4);
+        assert(pos + literalCount <= size);
+        std::memcpy(dst + pos, src, literalCount);
+        src += literalCount;
+        pos += literalCount;
+        if(src >= srcEnd) break;
+
+        const size_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        const auto matchLength = readLength(src, token & 15) + MIN_MATCH;
+        assert(offset > 0 && offset <= pos && pos + matchLength <= size);
+        // byte by byte, since the match may overlap the output (e.g. runs)
+        for(size_t i = 0; i < matchLength; ++i, ++pos) dst[pos] = dst[pos - offset];
+    }
+    assert(pos == size);
+}
+
+} // namespace ecs::lz
@@ -1,16 +1,197 @@
 #include "ecs.hpp"
 
+#include <stdexcept>
+#include <cstdio>
+
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#endif
+
+#if defined(__unix__)
+#include <dlfcn.h>
+#endif
+
 namespace ecs {
 
+std::string demangle(const char* name) {
+#if defined(__GNUG__)
+    int status = 0;
+    std::unique_ptr<char, void(*)(void*)> demangled(abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+    if(status == 0 && demangled) return demangled.get();
+#endif
+    return name; // MSVC names are readable already
+}
+
+const std::string& getFunctionName(void (*func)(), const char* typeName) {
+    // this is called every time a system is started, so only look the function up once
+    static std::mutex mutex;
+    static std::unordered_map<void (*)(), std::string> names;
+    std::lock_guard lock(mutex);
+    auto& name = names[func];
+    if(!name.empty()) return name;
+#if defined(__unix__)
+    // dladdr returns the closest symbol before the address, which might be a different function
+    Dl_info info;
+    if(dladdr(reinterpret_cast<void*>(func), &info) && info.dli_sname && info.dli_saddr == reinterpret_cast<void*>(func)) {
+        name = demangle(info.dli_sname);
+    }
+#endif
+    if(name.empty()) {
+        char address[32];
+        std::snprintf(address, sizeof(address), " at %p", reinterpret_cast<void*>(func));
+        name = demangle(typeName) + address;
+    }
+    return name;
+}
+
+int componentRegistry::find(const std::string& name) {
+    for(size_t componentId = 0; componentId < getCount(); ++componentId) {
+        if(infos[componentId].name == name) return componentId;
+    }
+    return -1;
+}
+
+void ComponentPoolBase::moveTo(ComponentPoolBase& dst, const std::vector<std::pair<EntityId, EntityId>>& entities) {
+    assert(info && info == dst.info);
+    if(info->triviallyRelocatable) {
+        for(const auto& [from, to] : entities) {
+            std::memcpy(dst.addRaw(to), getRaw(from, false), info->size);
+            release(from);
+        }
+    } else {
+        assert(info->move && "Component type must be move constructible to be migrated");
+        for(const auto& [from, to] : entities) {
+            auto component = getRaw(from, true);
+            info->move(dst.addRaw(to), component);
+            info->destroy(component);
+            release(from);
+        }
+    }
+}
+
+SystemHandle SystemHandle::pending() {
+    SystemHandle handle;
+    handle.mState = std::make_shared<State>();
+    return handle;
+}
+
+void SystemHandle::complete() {
+    if(!mState) return;
+    std::vector<std::function<void()>> continuations;
+    {
+        std::lock_guard lock(mState->mutex);
+        if(mState->done) return;
+        mState->done = true;
+        continuations.swap(mState->continuations);
+    }
+    mState->cv.notify_all();
+    for(auto& func : continuations) func();
+}
+
+bool SystemHandle::isDone() const {
+    if(!mState) return true;
+    std::lock_guard lock(mState->mutex);
+    return mState->done;
+}
+
+void SystemHandle::wait() const {
+    if(!mState) return;
+    std::unique_lock lock(mState->mutex);
+    mState->cv.wait(lock, [this]() { return mState->done; });
+}
+
+void SystemHandle::then(std::function<void()> func) {
+    if(mState) {
+        std::lock_guard lock(mState->mutex);
+        if(!mState->done) {
+            mState->continuations.push_back(std::move(func));
+            return;
+        }
+    }
+    func();
+}
+
+bool SystemHandle::waitFor(std::chrono::microseconds timeout) const {
+    if(!mState) return true;
+    std::unique_lock lock(mState->mutex);
+    return mState->cv.wait_for(lock, timeout, [this]() { return mState->done; });
+}
+
+void waitAll(const std::vector<SystemHandle>& handles) {
+    for(const auto& handle : handles) handle.wait();
+}
+
+void whenAll(const std::vector<SystemHandle>& handles, std::function<void()> func) {
+    if(handles.empty()) {
+        func();
+        return;
+    }
+    auto remaining = std::make_shared<std::atomic<size_t>>(handles.size());
+    for(auto handle : handles) {
+        handle.then([remaining, func]() {
+            if(--*remaining == 0) func();
+        });
+    }
+}
+
+void Coroutine::SystemHandleAwaiter::await_suspend(Handle coroutine) {
+    coroutine.promise().closeWindow();
+    coroutine.promise().world->scheduleCoroutine(coroutine, 0, 0, {handle}, false);
+}
+
+void Coroutine::FinalAwaiter::await_suspend(Handle coroutine) noexcept {
+    // complete the coroutine before its window, so it is done in the frame it finished in
+    auto window = std::exchange(coroutine.promise().window, SystemHandle());
+    auto done = coroutine.promise().done;
+    coroutine.destroy();
+    done.complete();
+    window.complete();
+}
+
+void World::NextFrameAwaiter::await_suspend(Coroutine::Handle coroutine) {
+    // The window may only be closed after the coroutine is queued, otherwise finishTick might resume the queued
+    // coroutines before it is in there. It might be resumed as soon as it is queued, so take the window out before.
+    auto window = std::exchange(coroutine.promise().window, SystemHandle());
+    {
+        std::lock_guard lock(world.mSystemsMutex);
+        world.mNextFrameCoroutines.push_back(coroutine);
+    }
+    window.complete();
+}
+
+void World::AccessAwaiter::await_suspend(Coroutine::Handle coroutine) {
+    // the coroutine might be resumed (and this awaiter destroyed) before scheduleCoroutine returns
+    auto& w = world;
+    const auto read = readMask, write = writeMask;
+    // The new window is registered before the old one is closed, so finishTick can't run in between. If they
+    // conflict, the new one just waits for the old one.
+    auto window = std::exchange(coroutine.promise().window, SystemHandle());
+    w.scheduleCoroutine(coroutine, read, write, {}, true);
+    window.complete();
+}
+
 World::EntityIterator& World::EntityIterator::operator++() {
-    mEntityIndex++;
     const auto& world = mList->world;
-    while (mEntityIndex < world.getEntityCount()
-           && (!world.isValid(mEntityIndex)
-           || !world.hasComponents(mEntityIndex, mList->mask))) mEntityIndex++;
-    if(mEntityIndex >= world.getEntityCount()) {
-        mEntityIndex = MAX_INDEX;
+    const auto count = world.getEntityCount();
+    // begin() starts at -1 (MAX_INDEX), so we start scanning at the first word
+    auto wordBegin = mEntityIndex == MAX_INDEX ? 0 : mEntityIndex / 64 * 64;
+    while (true) {
+        // only scan the next word of masks when we used up all matches of the current one
+        if (!mMatches) {
+            if (mEntityIndex != MAX_INDEX) wordBegin += 64;
+            if (wordBegin >= count) break;
+            scanMasks(world.mComponentMasks.data() + wordBegin, world.mEntityValid.data() + wordBegin / 64,
+                std::min<size_t>(count - wordBegin, 64), mList->mask, &mMatches);
+            mEntityIndex = wordBegin;
+            continue;
+        }
+        mEntityIndex = wordBegin + std::countr_zero(mMatches);
+        mMatches &= mMatches - 1;
+        // the entity might have been destroyed since the word was scanned
+        if (world.isValid(mEntityIndex) && world.hasComponents(mEntityIndex, mList->mask)) return *this;
     }
+    mEntityIndex = MAX_INDEX;
+    mMatches = 0;
     return *this;
 }
 
@@ -34,19 +215,44 @@ EntityHandle World::EntityIterator::operator*() const {
 
 EntityHandle World::createEntity() {
     std::lock_guard lock(mMutex);
+    return EntityHandle(*this, createEntityId());
+}
+
+EntityId World::createEntityId() {
+    EntityId entityId;
     if(mEntityIdFreeList.empty()) {
         mComponentMasks.push_back(0);
-        mEntityValid.push_back(false);
-        assert(mComponentMasks.size() == mEntityValid.size());
-        return EntityHandle(*this, mComponentMasks.size() - 1);
+        mModifiedTicks.push_back(0);
+        // new bits are already zero (invalid)
+        if(mComponentMasks.size() > mEntityValid.size() * 64) {
+            mEntityValid.push_back(0);
+            mModifiedTickMaxima.push_back(0);
+        }
+        entityId = mComponentMasks.size() - 1;
     } else {
-        const auto entityId = mEntityIdFreeList.top();
+        entityId = mEntityIdFreeList.top();
         mEntityIdFreeList.pop();
-        assert(entityId < mComponentMasks.size() && entityId < mEntityValid.size());
+        assert(entityId < mComponentMasks.size());
         mComponentMasks[entityId] = 0;
-        mEntityValid[entityId] = false;
-        return EntityHandle(*this, entityId);
+        mEntityValid[entityId / 64] &= ~(uint64_t(1) << (entityId % 64));
     }
+    // a new entity counts as modified
+    markModified(entityId, getTick());
+    return entityId;
+}
+
+void World::initPool(ComponentPoolBase& pool) {
+    pool.numaNodeCount = mWorkerPool->getNodeCount();
+    pool.epoch = &mEpoch;
+    pool.recycling = &mBlockRecycling;
+}
+
+void World::reserve(size_t entityCount) {
+    std::lock_guard lock(mMutex);
+    mComponentMasks.reserve(entityCount);
+    mEntityValid.reserve((entityCount + 63) / 64);
+    mModifiedTicks.reserve(entityCount);
+    mModifiedTickMaxima.reserve((entityCount + 63) / 64);
 }
 
 EntityHandle World::getEntityHandle(EntityId entityId) {
@@ -62,16 +268,249 @@ void World::destroyEntity(EntityId entityId) {
         if(mPools[compId] && hasComponent) mPools[compId]->remove(entityId);
     }
     mComponentMasks[entityId] = 0;
+    markModified(entityId, getTick()); // its components were removed
     mEntityIdFreeList.push(entityId);
 }
 
+EntityHandle World::cloneEntity(EntityId entityId) {
+    std::lock_guard lock(mMutex);
+    assert(entityId < mComponentMasks.size());
+    const auto clone = createEntityId();
+    const auto mask = mComponentMasks[entityId];
+    mComponentMasks[clone] = mask;
+    for(size_t compId = 0; compId < mPools.size(); ++compId) {
+        if(!(mask & (1ull << compId))) continue;
+        auto& pool = *mPools[compId];
+        // first, since it might copy a block shared with a fork (see copyOnWrite)
+        auto component = pool.addRaw(clone);
+        if(pool.info->triviallyCopyable) {
+            std::memcpy(component, pool.getRaw(entityId, false), pool.info->size);
+        } else {
+            assert(pool.info->copy && "Component type must be copy constructible to be cloned");
+            pool.info->copy(component, pool.getRaw(entityId, false));
+        }
+    }
+    return EntityHandle(*this, clone);
+}
+
+void World::destroyEntities(const std::vector<EntityId>& entities) {
+    std::lock_guard lock(mMutex);
+    assert(std::all_of(entities.begin(), entities.end(), [this](EntityId id) { return id < mComponentMasks.size(); }));
+    for(size_t compId = 0; compId < mPools.size(); ++compId) {
+        if(!mPools[compId]) continue;
+        for(const auto entityId : entities) {
+            if(mComponentMasks[entityId] & (1ull << compId)) mPools[compId]->remove(entityId);
+        }
+    }
+    const auto tick = getTick();
+    for(const auto entityId : entities) {
+        mComponentMasks[entityId] = 0;
+        markModified(entityId, tick);
+        mEntityIdFreeList.push(entityId);
+    }
+}
+
+std::vector<EntityId> World::migrate(const std::vector<EntityId>& entities, World& dst) {
+    assert(&dst != this);
+    // block every system and coroutine that might access components in either world while we move them
+    std::vector<SystemHandle> waitFor;
+    joinFinishedSystems();
+    auto handle = startSystem(0, ALL_COMPONENTS, waitFor).handle;
+    dst.joinFinishedSystems();
+    auto dstHandle = dst.startSystem(0, ALL_COMPONENTS, waitFor).handle;
+    waitForSystems(waitFor);
+
+    std::vector<EntityId> dstEntities(entities.size());
+    {
+        std::scoped_lock lock(mMutex, dst.mMutex);
+        for(size_t i = 0; i < entities.size(); ++i) {
+            assert(entities[i] < mComponentMasks.size());
+            dstEntities[i] = dst.createEntityId();
+            dst.mComponentMasks[dstEntities[i]] = mComponentMasks[entities[i]];
+        }
+
+        // one pool after the other, so we only touch the blocks of one component type at a time
+        std::vector<std::pair<EntityId, EntityId>> moves;
+        for(size_t compId = 0; compId < mPools.size(); ++compId) {
+            if(!mPools[compId]) continue;
+            moves.clear();
+            for(size_t i = 0; i < entities.size(); ++i) {
+                if(mComponentMasks[entities[i]] & (1ull << compId)) moves.emplace_back(entities[i], dstEntities[i]);
+            }
+            if(moves.empty()) continue;
+            if(!dst.mPools[compId]) {
+                dst.mPools[compId] = mPools[compId]->createEmpty();
+                dst.initPool(*dst.mPools[compId]);
+            }
+            mPools[compId]->moveTo(*dst.mPools[compId], moves);
+        }
+
+        // the components were removed here and added there
+        const auto tick = getTick(), dstTick = dst.getTick();
+        for(size_t i = 0; i < entities.size(); ++i) {
+            mComponentMasks[entities[i]] = 0;
+            markModified(entities[i], tick);
+            mEntityIdFreeList.push(entities[i]);
+            dst.markModified(dstEntities[i], dstTick);
+            dst.flush(dstEntities[i]);
+        }
+    }
+
+    handle.complete();
+    dstHandle.complete();
+    return dstEntities;
+}
+
+std::unique_ptr<World> World::fork() {
+    {
+        // the blocks would have to be copied by the first write to them in either world
+        std::lock_guard lock(mMutex);
+        for(const auto& pool : mPools) {
+            if(pool && !pool->info->copy) {
+                throw std::logic_error("Component " + pool->info->name + " is not copy constructible and can't be forked");
+            }
+        }
+    }
+
+    std::vector<SystemHandle> waitFor;
+    joinFinishedSystems();
+    auto handle = startSystem(ALL_COMPONENTS, 0, waitFor).handle;
+    waitForSystems(waitFor);
+
+    auto world = std::make_unique<World>(mWorkerPool);
+    {
+        std::lock_guard lock(mMutex);
+        world->mComponentMasks = mComponentMasks;
+        world->mEntityValid = mEntityValid;
+        world->mModifiedTicks = mModifiedTicks;
+        world->mModifiedTickMaxima = mModifiedTickMaxima;
+        world->mTick = mTick.load();
+        world->mEntityIdFreeList = mEntityIdFreeList;
+        world->mQueryOptions = mQueryOptions;
+        world->mDefaultQueryOptions = mDefaultQueryOptions;
+        world->mBlockRecycling.maxRetainedBytes = mBlockRecycling.maxRetainedBytes;
+        // the blocks remember when they were last accessed
+        world->mEpoch = mEpoch.load();
+        for(size_t compId = 0; compId < mPools.size(); ++compId) {
+            if(!mPools[compId]) continue;
+            world->mPools[compId] = mPools[compId]->fork();
+            world->initPool(*world->mPools[compId]);
+        }
+    }
+
+    handle.complete();
+    return world;
+}
+
+void World::queueMigration(EntityId entityId, World& dst) {
+    std::lock_guard lock(mMutex);
+    mMigrationQueue.emplace_back(entityId, &dst);
+}
+
+std::vector<World::Migration> World::migrateQueued() {
+    std::vector<std::pair<EntityId, World*>> queue;
+    {
+        std::lock_guard lock(mMutex);
+        queue.swap(mMigrationQueue);
+    }
+    // group by destination, so there is one batch per world
+    std::stable_sort(queue.begin(), queue.end(), [](const auto& a, const auto& b) { return a.second < b.second; });
+
+    std::vector<Migration> migrations;
+    std::vector<EntityId> batch;
+    for(size_t begin = 0; begin < queue.size();) {
+        auto dst = queue[begin].second;
+        batch.clear();
+        auto end = begin;
+        for(; end < queue.size() && queue[end].second == dst; ++end) batch.push_back(queue[end].first);
+        const auto dstEntities = migrate(batch, *dst);
+        for(size_t i = 0; i < batch.size(); ++i) migrations.push_back(Migration{dst, batch[i], dstEntities[i]});
+        begin = end;
+    }
+    return migrations;
+}
+
+SystemHandle World::forEachChunk(ComponentMask readMask, ComponentMask writeMask, bool parallelFor,
+                                 const std::function<void(const ColumnChunk&)>& func) {
+    const auto mask = readMask | writeMask;
+    assert(mask != 0);
+    joinFinishedSystems();
+    std::vector<SystemHandle> waitFor;
+    auto handle = startSystem(readMask & ~writeMask, writeMask, waitFor).handle;
+    waitForSystems(waitFor);
+
+    // chunks must not cross block boundaries, so a column is contiguous
+    std::vector<ComponentPoolBase*> pools;
+    std::vector<bool> writes;
+    size_t chunkSize = 64;
+    for(size_t compId = 0; compId < mPools.size(); ++compId) {
+        if(!(mask & (1ull << compId))) continue;
+        if(!mPools[compId]) { // no entity can have all components
+            handle.complete();
+            return handle;
+        }
+        pools.push_back(mPools[compId].get());
+        writes.push_back((writeMask & (1ull << compId)) > 0);
+        chunkSize = std::min(chunkSize, mPools[compId]->getBlockSize());
+    }
+    const auto chunkBits = chunkSize == 64 ? ~uint64_t(0) : (uint64_t(1) << chunkSize) - 1;
+    const auto tick = getTick();
+
+    auto processRange = [&](size_t begin, size_t end) {
+        assert(begin % 64 == 0);
+        ColumnChunk chunk;
+        chunk.columnCount = pools.size();
+        for(size_t c = 0; c < pools.size(); ++c) chunk.strides[c] = pools[c]->info->size;
+        uint64_t matches[WorkerPool::CHUNK_SIZE / 64];
+        for(auto pieceBegin = begin; pieceBegin < end; pieceBegin += WorkerPool::CHUNK_SIZE) {
+            const auto pieceEnd = std::min(end, pieceBegin + WorkerPool::CHUNK_SIZE);
+            scanMasks(mComponentMasks.data() + pieceBegin, mEntityValid.data() + pieceBegin / 64, pieceEnd - pieceBegin,
+                mask, matches);
+            for(size_t word = 0; word < (pieceEnd - pieceBegin + 63) / 64; ++word) {
+                for(size_t offset = 0; offset < 64; offset += chunkSize) {
+                    chunk.matches = (matches[word] >> offset) & chunkBits;
+                    if(!chunk.matches) continue;
+                    chunk.begin = pieceBegin + word * 64 + offset;
+                    // the pools only hand out pointers to occupied slots, so go back from the first match
+                    const auto first = std::countr_zero(chunk.matches);
+                    for(size_t c = 0; c < pools.size(); ++c) {
+                        chunk.columns[c] = static_cast<uint8_t*>(pools[c]->getRaw(chunk.begin + first, writes[c]))
+                            - first * chunk.strides[c];
+                    }
+                    if(writeMask) {
+                        for(auto bits = chunk.matches; bits; bits &= bits - 1) markModified(chunk.begin + std::countr_zero(bits), tick);
+                    }
+                    func(chunk);
+                }
+            }
+        }
+    };
+
+    if(parallelFor) {
+        mWorkerPool->parallelFor(getEntityCount(), processRange);
+    } else {
+        processRange(0, getEntityCount());
+    }
+    handle.complete();
+    return handle;
+}
+
+std::vector<EntityId> World::getMatchingEntities(ComponentMask mask) {
+    std::vector<EntityId> entities;
+    forEachEntityInRange(mask, 0, getEntityCount(), [&entities](EntityHandle e) { entities.push_back(e.getId()); });
+    return entities;
+}
+
 void World::flush() {
-    mEntityValid.assign(mEntityValid.size(), true);
+    mEntityValid.assign(mEntityValid.size(), ~uint64_t(0));
+    // keep the bits of entities that don't exist yet cleared
+    const auto count = getEntityCount();
+    if(count % 64 != 0) mEntityValid.back() = (uint64_t(1) << (count % 64)) - 1;
 }
 
 void World::flush(EntityId entityId) {
-    assert(entityId < mEntityValid.size());
-    mEntityValid[entityId] = true;
+    assert(entityId < getEntityCount());
+    mEntityValid[entityId / 64] |= uint64_t(1) << (entityId % 64);
 }
 
 bool World::hasComponents(EntityId entityId, ComponentMask mask) const {
@@ -84,23 +523,216 @@ ComponentMask World::getComponentMask(EntityId entityId) const {
     return mComponentMasks[entityId];
 }
 
-void World::waitForSystems(ComponentMask readMask, ComponentMask writeMask) {
+World::World(std::shared_ptr<WorkerPool> pool) : mWorkerPool(std::move(pool)) {
+    assert(mWorkerPool);
+}
+
+World::~World() {
+    joinSystemThreads();
+    std::lock_guard lock(mSystemsMutex);
+    for(auto coroutine : mNextFrameCoroutines) coroutine.destroy();
+}
+
+World::RunningSystem& World::startSystem(ComponentMask readMask, ComponentMask writeMask,
+                                         std::vector<SystemHandle>& dependencies) {
+    std::lock_guard lock(mSystemsMutex);
+    addConflicts(readMask, writeMask, dependencies);
+    mRunningSystems.emplace_back(std::make_unique<RunningSystem>(readMask, writeMask));
+    return *mRunningSystems.back();
+}
+
+void World::startSyncSystem(ComponentMask readMask, ComponentMask writeMask, std::vector<SystemHandle>& dependencies) {
+    std::lock_guard lock(mSystemsMutex);
+    addConflicts(readMask, writeMask, dependencies);
+    // only allocates the first time (or when more threads tick synchronously at once than ever before)
+    mSyncSystems.push_back(SyncSystem{readMask, writeMask, std::this_thread::get_id(), std::nullopt});
+}
+
+void World::finishSyncSystem() {
+    std::optional<SystemHandle> handle;
+    {
+        std::lock_guard lock(mSystemsMutex);
+        // systems ticked from within a system finish first, so the last one of this thread is ours
+        const auto thread = std::this_thread::get_id();
+        auto it = std::find_if(mSyncSystems.rbegin(), mSyncSystems.rend(),
+            [thread](const SyncSystem& system) { return system.thread == thread; });
+        assert(it != mSyncSystems.rend());
+        handle = std::move(it->handle);
+        mSyncSystems.erase(std::next(it).base());
+    }
+    // outside of the lock, because the continuations might start systems
+    if (handle) handle->complete();
+}
+
+void World::addConflicts(ComponentMask readMask, ComponentMask writeMask, std::vector<SystemHandle>& dependencies) {
+    // if a running system writes to a component we want to access or reads from a component we want to write to,
+    // we have to wait until it is finished
+    auto conflicts = [readMask, writeMask](ComponentMask otherRead, ComponentMask otherWrite) {
+        return (otherWrite & (readMask | writeMask)) > 0 || (otherRead & writeMask) > 0;
+    };
     for (auto& system : mRunningSystems) {
-        // if a running system writes to a component we want to read from or write to, wait until it is finished
-        if ((system->writeMask & (readMask | writeMask)) > 0) {
-            system->thread.join();
-            system->threadJoined = true;
-        }
+        if (conflicts(system->readMask, system->writeMask) && !system->handle.isDone())
+            dependencies.push_back(system->handle);
     }
+    for (auto& system : mSyncSystems) {
+        if (!conflicts(system.readMask, system.writeMask)) continue;
+        if (!system.handle) system.handle = SystemHandle::pending();
+        dependencies.push_back(*system.handle);
+    }
+}
+
+void World::joinFinishedSystems() {
+    std::lock_guard lock(mSystemsMutex);
     mRunningSystems.erase(
         std::remove_if(mRunningSystems.begin(), mRunningSystems.end(),
-            [](const std::unique_ptr<RunningSystem>& system) {return system->threadJoined; }),
+            [](const std::unique_ptr<RunningSystem>& system) { return system->handle.isDone(); }),
         mRunningSystems.end());
 }
 
+void World::waitForSystems(const std::vector<SystemHandle>& systems) {
+    if (std::all_of(systems.begin(), systems.end(), [](const SystemHandle& system) { return system.isDone(); })) return;
+    const auto start = std::chrono::steady_clock::now();
+    if (!WorkerPool::isWorkerThread()) {
+        waitAll(systems);
+    } else {
+        for (const auto& system : systems) {
+            // the systems might need a worker (e.g. coroutines) and we might be blocking the last one
+            while (!system.isDone()) {
+                if (!mWorkerPool->runPendingJob(this)) system.waitFor(std::chrono::microseconds(100));
+            }
+        }
+    }
+    mSystemWaits.fetch_add(1, std::memory_order_relaxed);
+    mSystemWaitNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+}
+
+WaitStats World::getWaitStats() const {
+    WaitStats stats;
+    stats.systemWaits = mSystemWaits.load(std::memory_order_relaxed);
+    stats.systemWaitSeconds = mSystemWaitNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+    stats.mutexContentions = mMutex.getContentions();
+    stats.mutexWaitSeconds = mMutex.getWaitNanoseconds() * 1e-9;
+    return stats;
+}
+
+void World::resetWaitStats() {
+    mSystemWaits = 0;
+    mSystemWaitNanoseconds = 0;
+    mMutex.resetStats();
+}
+
 void World::joinSystemThreads() {
-    for (auto& system : mRunningSystems) system->thread.join();
-    mRunningSystems.clear();
+    stopSystems().complete();
+    joinFinishedSystems();
+}
+
+SystemHandle World::stopSystems() {
+    // Blocks retired from now on might still be in use by systems that are started while we wait,
+    // but all systems that could use blocks retired before are done when we return.
+    const auto safeEpoch = ++mEpoch;
+
+    // coroutines may register new running systems while we wait, so repeat until there are none left
+    SystemHandle window;
+    while (true) {
+        std::vector<SystemHandle> handles;
+        {
+            std::lock_guard lock(mSystemsMutex);
+            // not addConflicts, because coroutines might run without accessing any components
+            for (auto& system : mRunningSystems) {
+                if (!system->handle.isDone()) handles.push_back(system->handle);
+            }
+            for (auto& system : mSyncSystems) {
+                if (!system.handle) system.handle = SystemHandle::pending();
+                handles.push_back(*system.handle);
+            }
+            // registered under the same lock, so nothing can start in between
+            if (handles.empty()) {
+                mRunningSystems.emplace_back(std::make_unique<RunningSystem>(0, ALL_COMPONENTS));
+                window = mRunningSystems.back()->handle;
+                break;
+            }
+        }
+        waitForSystems(handles);
+        joinFinishedSystems();
+    }
+
+    std::lock_guard lock(mMutex);
+    for (auto& pool : mPools) {
+        if (!pool) continue;
+        pool->reclaimBlocks(safeEpoch);
+        pool->compressColdBlocks(*mWorkerPool);
+    }
+    if (!mBlockRecycling.toRelease.empty()) {
+        mWorkerPool->submit([blocks = std::move(mBlockRecycling.toRelease)]() {
+            for (const auto& block : blocks) numa::free(block.data, block.size, block.node);
+        });
+        mBlockRecycling.toRelease.clear();
+    }
+    return window;
+}
+
+void World::setMaxRetainedBlockMemory(size_t bytes) {
+    std::lock_guard lock(mMutex);
+    // blocks retained beyond the new maximum are kept until they are reused
+    mBlockRecycling.maxRetainedBytes = bytes;
+}
+
+size_t World::getRetainedBlockMemory() const {
+    std::lock_guard lock(mMutex);
+    return mBlockRecycling.retainedBytes;
+}
+
+SystemHandle World::spawn(Coroutine coroutine) {
+    auto handle = coroutine.release();
+    assert(handle);
+    handle.promise().world = this;
+    handle.promise().done = SystemHandle::pending();
+    auto done = handle.promise().done;
+    scheduleCoroutine(handle, 0, 0, {}, true);
+    return done;
+}
+
+void World::scheduleCoroutine(Coroutine::Handle coroutine, ComponentMask readMask, ComponentMask writeMask,
+                              std::vector<SystemHandle> dependencies, bool registerNow) {
+    auto resume = [this, coroutine](SystemHandle window) {
+        mWorkerPool->submit([coroutine, window]() {
+            coroutine.promise().window = window;
+            coroutine.resume();
+        }, this);
+    };
+
+    // Access windows have to be registered immediately, so that systems ticked after the co_await wait for them.
+    // Otherwise we only register when the dependencies are done, so finishTick doesn't wait for them.
+    if (registerNow) {
+        auto window = startSystem(readMask, writeMask, dependencies).handle;
+        whenAll(dependencies, [resume, window]() { resume(window); });
+    } else {
+        whenAll(dependencies, [this, resume, readMask, writeMask]() {
+            std::vector<SystemHandle> conflicts;
+            auto window = startSystem(readMask, writeMask, conflicts).handle;
+            whenAll(conflicts, [resume, window]() { resume(window); });
+        });
+    }
+}
+
+void World::resumeNextFrameCoroutines() {
+    std::vector<Coroutine::Handle> coroutines;
+    {
+        std::lock_guard lock(mSystemsMutex);
+        coroutines.swap(mNextFrameCoroutines);
+    }
+    for (auto coroutine : coroutines) scheduleCoroutine(coroutine, 0, 0, {}, true);
+}
+
+void World::setWorkerPool(std::shared_ptr<WorkerPool> pool) {
+    assert(pool);
+    joinSystemThreads();
+    mWorkerPool = std::move(pool);
+    // blocks remember the node they were allocated on, so this only affects blocks allocated from now on
+    for(auto& componentPool : mPools) {
+        if(componentPool) componentPool->numaNodeCount = mWorkerPool->getNodeCount();
+    }
 }
 
 // EntityHandle implementation
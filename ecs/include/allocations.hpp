@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace ecs {
+
+struct AllocationCounters {
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> bytes = 0;
+};
+
+// When built with ECS_TRACK_ALLOCATIONS (a CMake option), global operator new is replaced and every allocation is
+// added to the counters of the innermost scope on the calling thread. Otherwise scopes do nothing.
+class AllocationScope {
+public:
+#if defined(ECS_TRACK_ALLOCATIONS)
+    static constexpr bool enabled = true;
+
+    // nullptr stops counting until the scope ends
+    explicit AllocationScope(AllocationCounters* counters);
+    ~AllocationScope();
+#else
+    static constexpr bool enabled = false;
+
+    explicit AllocationScope(AllocationCounters*) {}
+#endif
+
+    AllocationScope(const AllocationScope& other) = delete;
+    AllocationScope& operator=(const AllocationScope& other) = delete;
+
+private:
+#if defined(ECS_TRACK_ALLOCATIONS)
+    AllocationCounters* mPrevious;
+#endif
+};
+
+} // namespace ecs
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ecs::lz {
+
+// A small LZ77 compressor in the style of LZ4 (byte oriented, 64 KiB window), which is fast enough to compress
+// component blocks in between ticks. The output is not compatible with the LZ4 format.
+
+// Upper bound for the size of the compressed data
+size_t maxCompressedSize(size_t size);
+
+// dst needs maxCompressedSize(size) bytes, returns the size of the compressed data
+size_t compress(const uint8_t* src, size_t size, uint8_t* dst);
+
+// dst needs the uncompressed size
+void decompress(const uint8_t* src, size_t compressedSize, uint8_t* dst, size_t size);
+
+} // namespace ecs::lz
@@ -11,11 +11,39 @@
 #include <tuple>
 #include <bitset>
 #include <array>
+#include <cmath>
+#include <bit>
+#include <unordered_map>
+#include <queue>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <coroutine>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <string>
+#include <typeinfo>
+#include <optional>
+
+#include "workerpool.hpp"
+#include "numa.hpp"
+#include "maskscan.hpp"
+#include "compress.hpp"
+#include "perfcounters.hpp"
+
+#if defined(__GNUC__)
+#define ECS_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define ECS_PREFETCH(address) ((void)(address))
+#endif
 
 namespace ecs {
 
 using ComponentMask = uint64_t;
 static_assert(std::is_unsigned<ComponentMask>::value, "ComponentMask type must be unsigned");
+static_assert(std::is_same<ComponentMask, uint64_t>::value, "scanMasks expects 64 bit component masks");
 static const ComponentMask ALL_COMPONENTS = std::numeric_limits<ComponentMask>::max();
 static const size_t MAX_COMPONENTS = std::numeric_limits<ComponentMask>::digits;
 
@@ -26,32 +54,189 @@ using IndexType = size_t;
 static const IndexType MAX_INDEX = std::numeric_limits<IndexType>::max();
 
 
+// Returns the readable name of a type from typeid(T).name()
+std::string demangle(const char* name);
+
+// Returns the symbol name of a function if it can be found (it has to be exported), otherwise typeName and the address.
+// The names are cached, so the reference stays valid.
+const std::string& getFunctionName(void (*func)(), const char* typeName);
+
+// Runtime information about a component type, so pools can be handled without knowing their type
+struct ComponentInfo {
+    size_t size = 0;
+    size_t alignment = 0;
+    bool triviallyCopyable = false;
+    // can be moved by copying its bytes and forgetting the original (see isTriviallyRelocatable)
+    bool triviallyRelocatable = false;
+    std::string name;
+    // construct a copy in the uninitialized memory at dst, nullptr if the type is not copy/move constructible
+    void (*copy)(void* dst, const void* src) = nullptr;
+    void (*move)(void* dst, void* src) = nullptr;
+    void (*destroy)(void* component) = nullptr;
+};
+
+// Components that are not trivially copyable, but don't care about their address (e.g. they own a heap allocation
+// through a pointer) can declare `static constexpr bool TRIVIALLY_RELOCATABLE = true;` to be moved with memcpy.
+template <typename T, typename = void>
+struct isTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+template <typename T>
+struct isTriviallyRelocatable<T, std::void_t<decltype(T::TRIVIALLY_RELOCATABLE)>>
+    : std::bool_constant<std::is_trivially_copyable<T>::value || T::TRIVIALLY_RELOCATABLE> {};
+
+namespace componentRegistry {
+    // indexed by component id, filled by componentId::get
+    inline std::array<ComponentInfo, MAX_COMPONENTS> infos;
+
+    template <typename ComponentType>
+    ComponentInfo makeInfo() {
+        ComponentInfo info;
+        info.size = sizeof(ComponentType);
+        info.alignment = alignof(ComponentType);
+        info.triviallyCopyable = std::is_trivially_copyable<ComponentType>::value;
+        info.triviallyRelocatable = isTriviallyRelocatable<ComponentType>::value;
+        info.name = demangle(typeid(ComponentType).name());
+        if constexpr(std::is_copy_constructible<ComponentType>::value) {
+            info.copy = [](void* dst, const void* src) { new(dst) ComponentType(*static_cast<const ComponentType*>(src)); };
+        }
+        if constexpr(std::is_move_constructible<ComponentType>::value) {
+            info.move = [](void* dst, void* src) { new(dst) ComponentType(std::move(*static_cast<ComponentType*>(src))); };
+        }
+        info.destroy = [](void* component) { static_cast<ComponentType*>(component)->~ComponentType(); };
+        return info;
+    }
+
+    size_t getCount();
+
+    inline const ComponentInfo& get(size_t componentId) {
+        assert(componentId < getCount());
+        return infos[componentId];
+    }
+
+    // Returns the id of the component with the given name (see ComponentInfo::name) or -1
+    int find(const std::string& name);
+}
+
 namespace componentId {
-    static size_t idCounter = 0;
+    // inline, so all translation units share the ids
+    inline std::mutex registrationMutex;
+    // Only incremented after the registry entry is written, so everything below it can be read without the mutex
+    inline std::atomic<size_t> idCounter = 0;
 
     template <typename ComponentType>
     size_t get() {
-        static auto id = idCounter++;
+        static auto id = []() {
+            std::lock_guard lock(registrationMutex);
+            const auto id = idCounter.load(std::memory_order_relaxed);
+            assert(id < MAX_COMPONENTS);
+            componentRegistry::infos[id] = componentRegistry::makeInfo<ComponentType>();
+            idCounter.store(id + 1, std::memory_order_release);
+            return id;
+        }();
         assert(id < MAX_COMPONENTS);
         return id;
     }
 }
 
+inline size_t componentRegistry::getCount() {
+    return componentId::idCounter.load(std::memory_order_acquire);
+}
+
+// The name of a system in profiles: FuncType::NAME for function objects that have one, the function itself for
+// function pointers (all functions with the same signature have the same type), otherwise the type name (for lambdas
+// that is the enclosing function and the signature).
+template <typename FuncType>
+const std::string& getSystemName(const FuncType& func) {
+    if constexpr(std::is_pointer<FuncType>::value && std::is_function<typename std::remove_pointer<FuncType>::type>::value) {
+        return getFunctionName(reinterpret_cast<void (*)()>(func), typeid(FuncType).name());
+    } else {
+        static const std::string name = []() {
+            if constexpr(requires { FuncType::NAME; }) {
+                return std::string(FuncType::NAME);
+            } else {
+                return demangle(typeid(FuncType).name());
+            }
+        }();
+        return name;
+    }
+}
+
 template <typename... Args>
 ComponentMask componentMask() {
     return (... | (1ull << componentId::get<typename std::remove_const<Args>::type>()));
 }
 
 
+template <bool isConst, typename ComponentType>
+ComponentMask _constFilteredComponentMask() {
+    if constexpr(std::is_const<ComponentType>::value == isConst) {
+        return componentMask<ComponentType>();
+    } else {
+        return 0;
+    }
+}
+
+template <bool isConst, typename... Args>
+ComponentMask constFilteredComponentMask() {
+    return (... | _constFilteredComponentMask<isConst, Args>());
+}
+
+
+struct BlockAllocation {
+    void* data;
+    size_t size;
+    int node;
+};
+
+// Shared by all pools of a world. Reclaimed blocks are kept for reuse while all pools retain less than
+// maxRetainedBytes in total, the others are collected in toRelease and freed in the background by the world.
+struct BlockRecycling {
+    static const size_t DEFAULT_MAX_RETAINED_BYTES = 4 * 1024 * 1024;
+
+    size_t maxRetainedBytes = DEFAULT_MAX_RETAINED_BYTES;
+    size_t retainedBytes = 0;
+    std::vector<BlockAllocation> toRelease;
+};
+
 struct ComponentPoolBase {
     virtual ~ComponentPoolBase() = default;
     virtual void remove(EntityId entityId) = 0;
+    // Recycles or frees blocks that were retired in an epoch before safeEpoch
+    virtual void reclaimBlocks(uint64_t safeEpoch) = 0;
+    // Returns an empty pool for the same component type (used to create pools in other worlds)
+    virtual std::unique_ptr<ComponentPoolBase> createEmpty() const = 0;
+    // Moves the component of every (from, to) pair to the entity "to" in dst, which has to be a pool of the same type.
+    // Trivially relocatable components are just memcpy'd.
+    void moveTo(ComponentPoolBase& dst, const std::vector<std::pair<EntityId, EntityId>>& entities);
+    // Compresses the blocks that were not accessed for more than coldTicks epochs
+    virtual void compressColdBlocks(WorkerPool& workerPool) = 0;
+    // Returns a pool with the same components, which shares all blocks with this one until either pool writes to them
+    virtual std::unique_ptr<ComponentPoolBase> fork() = 0;
+
+    // Type-erased access for generic operations (see ComponentInfo)
+    virtual size_t getBlockSize() const = 0;
+    virtual void* getRaw(EntityId entityId, bool write) = 0;
+    // Marks the slot of the entity as occupied and returns it uninitialized
+    virtual void* addRaw(EntityId entityId) = 0;
+    // Frees the slot of the entity without destroying the component (after its bytes were relocated)
+    virtual void release(EntityId entityId) = 0;
+
+    const ComponentInfo* info = nullptr;
+    // if > 1, blocks are allocated on the NUMA node owning their first entity (see WorkerPool)
+    size_t numaNodeCount = 1;
+    // Unused blocks are retired with the current epoch and only reclaimed when all systems that might still
+    // read from them have finished (see World::joinSystemThreads).
+    const std::atomic<uint64_t>* epoch = nullptr;
+    // if nullptr, reclaimed blocks are freed immediately
+    BlockRecycling* recycling = nullptr;
+    // 0 = never compress blocks (see World::setColdCompression)
+    size_t coldTicks = 0;
 };
 
 template <typename ComponentType>
 class ComponentPool : public ComponentPoolBase {
 public:
-    ComponentPool() = default;
+    ComponentPool() { info = &componentRegistry::get(componentId::get<ComponentType>()); }
     ~ComponentPool();
     ComponentPool(const ComponentPool& other) = delete;
     ComponentPool& operator=(const ComponentPool& other) = delete;
@@ -61,12 +246,73 @@ public:
 
     bool has(EntityId entityId) const;
 
-    ComponentType& get(EntityId entityId);
+    // If write is true and the block is shared with a fork, it is copied first
+    ComponentType& get(EntityId entityId, bool write = true);
+
+    // Makes room in the block table for entities with ids < entityCount and optionally allocates their blocks
+    void reserve(size_t entityCount, bool allocateBlocks);
 
     void remove(EntityId entityId) override;
 
+    void reclaimBlocks(uint64_t safeEpoch) override;
+
+    std::unique_ptr<ComponentPoolBase> createEmpty() const override {
+        return std::make_unique<ComponentPool<ComponentType>>();
+    }
+
+    void compressColdBlocks(WorkerPool& workerPool) override;
+
+    std::unique_ptr<ComponentPoolBase> fork() override;
+
+    size_t getBlockSize() const override { return BLOCK_SIZE; }
+
+    void* getRaw(EntityId entityId, bool write) override { return &get(entityId, write); }
+
+    void* addRaw(EntityId entityId) override;
+
+    void release(EntityId entityId) override;
+
     static const size_t DEFAULT_BLOCK_SIZE = 64;
 
+    // Caches the pointer to the block of the last accessed component, for sequential iteration
+    class Cursor {
+    public:
+        Cursor(ComponentPool& pool, bool prefetch, bool write) :
+            mPool(pool), mBlockIndex(MAX_INDEX), mBlockData(nullptr), mPrefetch(prefetch), mWrite(write) {}
+
+        ComponentType& get(EntityId entityId) {
+            const auto [blockIndex, componentIndex] = getIndices(entityId);
+            if(blockIndex != mBlockIndex) {
+                mBlockIndex = blockIndex;
+                mBlockData = mPool.getPointer(blockIndex, 0, mWrite);
+                if(mPrefetch && blockIndex + 1 < mPool.mBlocks.size()) {
+                    const auto next = mPool.loadData(mPool.mBlocks[blockIndex + 1]);
+                    if(next) ECS_PREFETCH(next);
+                }
+            }
+            assert(mPool.mBlocks[blockIndex].occupied[componentIndex]);
+            return mBlockData[componentIndex];
+        }
+
+        void prefetch(EntityId entityId) const {
+            const auto [blockIndex, componentIndex] = getIndices(entityId);
+            if(blockIndex < mPool.mBlocks.size()) {
+                const auto data = mPool.loadData(mPool.mBlocks[blockIndex]);
+                if(data) ECS_PREFETCH(reinterpret_cast<ComponentType*>(data) + componentIndex);
+            }
+        }
+
+    private:
+        ComponentPool& mPool;
+        size_t mBlockIndex;
+        ComponentType* mBlockData;
+        bool mPrefetch;
+        bool mWrite;
+    };
+
+    // Cursors for writing copy blocks shared with forks when they enter them
+    Cursor getCursor(bool prefetch = false, bool write = true) { return Cursor(*this, prefetch, write); }
+
 private:
     // https://gist.github.com/pfirsich/72ec22c4407013eccfab3a78f2ac7a23
     template <class T>
@@ -81,49 +327,121 @@ private:
     }
 
     static const size_t BLOCK_SIZE = getBlockSizeImpl(static_cast<ComponentType*>(nullptr), 0);
-    static_assert(BLOCK_SIZE > 0);
+    static_assert(BLOCK_SIZE > 0 && (BLOCK_SIZE & (BLOCK_SIZE - 1)) == 0, "BLOCK_SIZE must be a power of two");
+    static const size_t BLOCK_SHIFT = std::countr_zero(BLOCK_SIZE);
     static const size_t COMPONENT_SIZE = sizeof(ComponentType);
 
     static constexpr auto getIndices(EntityId entityId) {
-        return std::pair<size_t, size_t>(entityId / BLOCK_SIZE, entityId % BLOCK_SIZE);
+        return std::pair<size_t, size_t>(entityId >> BLOCK_SHIFT, entityId & (BLOCK_SIZE - 1));
     }
 
-    ComponentType* getPointer(size_t blockIndex, size_t componentIndex) {
-        assert(mBlocks[blockIndex].data);
-        return reinterpret_cast<ComponentType*>(mBlocks[blockIndex].data) + componentIndex;
+    struct Block {
+        void* data; // nullptr if unallocated or compressed
+        int node; // -1 if not allocated on a specific NUMA node
+        std::bitset<BLOCK_SIZE> occupied;
+        uint64_t lastAccess; // epoch, only tracked if coldTicks > 0
+        // Immutable, so forks just share it and each pool decompresses its own copy when it is accessed
+        std::shared_ptr<const std::vector<uint8_t>> compressed;
+        // Number of pools using data, if it is shared with forks. Reset by the first write (see copyOnWrite).
+        std::atomic<uint32_t>* shared;
+        Block() : data(nullptr), node(-1), occupied(), lastAccess(0), shared(nullptr) {}
+    };
+
+    // Blocks are decompressed by whichever thread accesses them first, so data has to be read atomically
+    static void* loadData(Block& block) {
+        return std::atomic_ref<void*>(block.data).load(std::memory_order_acquire);
     }
 
+    ComponentType* getPointer(size_t blockIndex, size_t componentIndex, bool write) {
+        auto& block = mBlocks[blockIndex];
+        auto data = loadData(block);
+        if(!data) data = decompressBlock(blockIndex);
+        if(write && std::atomic_ref<std::atomic<uint32_t>*>(block.shared).load(std::memory_order_acquire)) {
+            data = copyOnWrite(blockIndex);
+        }
+        if(coldTicks > 0 && epoch) {
+            // only write if it changed, so threads reading the same block don't keep invalidating the cache line
+            std::atomic_ref<uint64_t> lastAccess(block.lastAccess);
+            const auto now = epoch->load(std::memory_order_relaxed);
+            if(lastAccess.load(std::memory_order_relaxed) != now) lastAccess.store(now, std::memory_order_relaxed);
+        }
+        return reinterpret_cast<ComponentType*>(data) + componentIndex;
+    }
+
+    void* decompressBlock(size_t blockIndex);
+    void* copyOnWrite(size_t blockIndex);
     void checkBlockUsage(size_t blockIndex);
 
-    struct Block {
+    std::vector<Block> mBlocks;
+    // for decompressing and copying blocks, which might happen in parallel systems
+    std::mutex mBlockMutex;
+
+    struct RetiredBlock {
         void* data;
-        std::bitset<BLOCK_SIZE> occupied;
-        Block() : data(nullptr), occupied() {}
+        int node;
+        uint64_t epoch;
     };
-    std::vector<Block> mBlocks;
+    std::vector<RetiredBlock> mRetiredBlocks;
+    std::vector<RetiredBlock> mFreeBlocks;
 };
 
 template <typename ComponentType>
 ComponentPool<ComponentType>::~ComponentPool() {
     for(auto& block : mBlocks) {
-        operator delete(block.data);
+        // the last pool sharing a block frees it
+        if(block.shared && block.shared->fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+        delete block.shared;
+        numa::free(block.data, BLOCK_SIZE * COMPONENT_SIZE, block.node);
         block.data = nullptr;
     }
+    for(auto& block : mRetiredBlocks) numa::free(block.data, BLOCK_SIZE * COMPONENT_SIZE, block.node);
+    for(auto& block : mFreeBlocks) numa::free(block.data, BLOCK_SIZE * COMPONENT_SIZE, block.node);
 }
 
 template <typename ComponentType>
 template <typename... Args>
 ComponentType& ComponentPool<ComponentType>::add(EntityId entityId, Args... args) {
+    return *new(addRaw(entityId)) ComponentType(std::forward<Args>(args)...);
+}
+
+template <typename ComponentType>
+void* ComponentPool<ComponentType>::addRaw(EntityId entityId) {
     assert(!has(entityId));
     const auto [blockIndex, componentIndex] = getIndices(entityId);
 
     if(mBlocks.size() < blockIndex + 1) mBlocks.resize(blockIndex + 1);
     auto& block = mBlocks[blockIndex];
-    if(!block.data) block.data = operator new(BLOCK_SIZE * COMPONENT_SIZE);
+    if(!block.data && block.compressed) decompressBlock(blockIndex);
+    if(!block.data) {
+        block.node = numaNodeCount > 1 ? static_cast<int>((blockIndex * BLOCK_SIZE / WorkerPool::CHUNK_SIZE) % numaNodeCount) : -1;
+        const auto freeBlock = std::find_if(mFreeBlocks.begin(), mFreeBlocks.end(),
+            [&block](const RetiredBlock& free) { return free.node == block.node; });
+        if(freeBlock != mFreeBlocks.end()) {
+            block.data = freeBlock->data;
+            *freeBlock = mFreeBlocks.back();
+            mFreeBlocks.pop_back();
+            if(recycling) recycling->retainedBytes -= BLOCK_SIZE * COMPONENT_SIZE;
+        } else {
+            block.data = numa::allocate(BLOCK_SIZE * COMPONENT_SIZE, block.node);
+        }
+    }
+    // before marking it occupied, so a copy of a shared block doesn't copy the new slot
+    const auto pointer = getPointer(blockIndex, componentIndex, true);
     block.occupied[componentIndex] = true;
-    auto component = new(getPointer(blockIndex, componentIndex)) ComponentType(std::forward<Args>(args)...);
+    return pointer;
+}
 
-    return *component;
+template <typename ComponentType>
+void ComponentPool<ComponentType>::reserve(size_t entityCount, bool allocateBlocks) {
+    const auto blockCount = (entityCount + BLOCK_SIZE - 1) >> BLOCK_SHIFT;
+    if(mBlocks.size() < blockCount) mBlocks.resize(blockCount);
+    if(!allocateBlocks) return;
+    for(size_t blockIndex = 0; blockIndex < blockCount; ++blockIndex) {
+        auto& block = mBlocks[blockIndex];
+        if(block.data || block.compressed) continue;
+        block.node = numaNodeCount > 1 ? static_cast<int>((blockIndex * BLOCK_SIZE / WorkerPool::CHUNK_SIZE) % numaNodeCount) : -1;
+        block.data = numa::allocate(BLOCK_SIZE * COMPONENT_SIZE, block.node);
+    }
 }
 
 template <typename ComponentType>
@@ -133,18 +451,23 @@ bool ComponentPool<ComponentType>::has(EntityId entityId) const {
 }
 
 template <typename ComponentType>
-ComponentType& ComponentPool<ComponentType>::get(EntityId entityId) {
+ComponentType& ComponentPool<ComponentType>::get(EntityId entityId, bool write) {
     assert(has(entityId));
     const auto [blockIndex, componentIndex] = getIndices(entityId);
-    return *getPointer(blockIndex, componentIndex);
+    return *getPointer(blockIndex, componentIndex, write);
 }
 
 template <typename ComponentType>
 void ComponentPool<ComponentType>::remove(EntityId entityId) {
+    get(entityId).~ComponentType();
+    release(entityId);
+}
+
+template <typename ComponentType>
+void ComponentPool<ComponentType>::release(EntityId entityId) {
     assert(has(entityId));
     const auto [blockIndex, componentIndex] = getIndices(entityId);
-    auto component = getPointer(blockIndex, componentIndex);
-    component->~ComponentType();
+    getPointer(blockIndex, componentIndex, true); // the block might be retired, so it must not be shared with a fork
     mBlocks[blockIndex].occupied[componentIndex] = false;
     checkBlockUsage(blockIndex);
 }
@@ -153,11 +476,288 @@ template <typename ComponentType>
 void ComponentPool<ComponentType>::checkBlockUsage(size_t blockIndex) {
     auto& block = mBlocks[blockIndex];
     if(block.occupied.none()) { // block is unused
-        operator delete(block.data);
+        // another thread might still be reading from it, so we can only free it later
+        mRetiredBlocks.push_back(RetiredBlock{block.data, block.node, epoch ? epoch->load() : 0});
         block.data = nullptr;
     }
 }
 
+template <typename ComponentType>
+void ComponentPool<ComponentType>::reclaimBlocks(uint64_t safeEpoch) {
+    auto it = std::partition(mRetiredBlocks.begin(), mRetiredBlocks.end(),
+        [safeEpoch](const RetiredBlock& block) { return block.epoch >= safeEpoch; });
+    const auto size = BLOCK_SIZE * COMPONENT_SIZE;
+    for(auto reclaim = it; reclaim != mRetiredBlocks.end(); ++reclaim) {
+        if(!recycling) {
+            numa::free(reclaim->data, size, reclaim->node);
+        } else if(recycling->retainedBytes + size <= recycling->maxRetainedBytes) {
+            mFreeBlocks.push_back(*reclaim);
+            recycling->retainedBytes += size;
+        } else {
+            recycling->toRelease.push_back(BlockAllocation{reclaim->data, size, reclaim->node});
+        }
+    }
+    mRetiredBlocks.erase(it, mRetiredBlocks.end());
+}
+
+template <typename ComponentType>
+void* ComponentPool<ComponentType>::decompressBlock(size_t blockIndex) {
+    std::lock_guard lock(mBlockMutex);
+    auto& block = mBlocks[blockIndex];
+    if(block.data) return block.data; // another thread was faster
+    assert(block.compressed);
+    auto data = numa::allocate(BLOCK_SIZE * COMPONENT_SIZE, block.node);
+    lz::decompress(block.compressed->data(), block.compressed->size(), static_cast<uint8_t*>(data), BLOCK_SIZE * COMPONENT_SIZE);
+    block.compressed.reset();
+    std::atomic_ref<void*>(block.data).store(data, std::memory_order_release);
+    return data;
+}
+
+template <typename ComponentType>
+void ComponentPool<ComponentType>::compressColdBlocks(WorkerPool& workerPool) {
+    // the bytes are moved to a different address when decompressing, so only for trivially copyable components
+    if constexpr(std::is_trivially_copyable<ComponentType>::value) {
+        if(coldTicks == 0 || !epoch) return;
+        const auto now = epoch->load();
+        std::vector<size_t> cold;
+        for(size_t blockIndex = 0; blockIndex < mBlocks.size(); ++blockIndex) {
+            const auto& block = mBlocks[blockIndex];
+            // Shared blocks are left alone, we would have to coordinate with all forks. Blocks without components were
+            // only reserved and never written, so there is nothing worth compressing in them.
+            if(!block.data || block.shared || block.occupied.none()) continue;
+            if(now - block.lastAccess > coldTicks) cold.push_back(blockIndex);
+        }
+        if(cold.empty()) return;
+
+        const auto size = BLOCK_SIZE * COMPONENT_SIZE;
+        workerPool.parallelFor(cold.size(), 1, [this, &cold, size, now](size_t begin, size_t end) {
+            std::vector<uint8_t> buffer(lz::maxCompressedSize(size));
+            for(auto i = begin; i < end; ++i) {
+                auto& block = mBlocks[cold[i]];
+                const auto compressedSize = lz::compress(static_cast<const uint8_t*>(block.data), size, buffer.data());
+                if(compressedSize > size / 4 * 3) { // not worth it, check again in coldTicks
+                    block.lastAccess = now;
+                    continue;
+                }
+                block.compressed = std::make_shared<const std::vector<uint8_t>>(buffer.begin(), buffer.begin() + compressedSize);
+            }
+        });
+
+        // the uncompressed blocks go the same way as unused ones
+        for(const auto blockIndex : cold) {
+            auto& block = mBlocks[blockIndex];
+            if(!block.compressed) continue;
+            mRetiredBlocks.push_back(RetiredBlock{block.data, block.node, now});
+            block.data = nullptr;
+        }
+    }
+}
+
+template <typename ComponentType>
+void* ComponentPool<ComponentType>::copyOnWrite(size_t blockIndex) {
+    std::lock_guard lock(mBlockMutex);
+    auto& block = mBlocks[blockIndex];
+    if(!block.shared) return block.data; // another thread was faster
+    auto data = block.data;
+    // If we are the only one left, nobody can share it with us again (only we could fork it), so just keep it.
+    // Otherwise copy it and let go of the original afterwards. If all others let go of it in the meantime, we were
+    // the last one and have to free it.
+    if(block.shared->load(std::memory_order_acquire) > 1) {
+        if constexpr(std::is_copy_constructible<ComponentType>::value) {
+            data = numa::allocate(BLOCK_SIZE * COMPONENT_SIZE, block.node);
+            if constexpr(std::is_trivially_copyable<ComponentType>::value) {
+                std::memcpy(data, block.data, BLOCK_SIZE * COMPONENT_SIZE);
+            } else {
+                for(size_t i = 0; i < BLOCK_SIZE; ++i) {
+                    if(block.occupied[i]) new(static_cast<ComponentType*>(data) + i) ComponentType(static_cast<const ComponentType*>(block.data)[i]);
+                }
+            }
+        } else {
+            assert(false && "Component type must be copy constructible to be forked"); // World::fork refuses these
+        }
+    }
+    if(block.shared->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete block.shared;
+        if(data != block.data) numa::free(block.data, BLOCK_SIZE * COMPONENT_SIZE, block.node);
+    }
+    std::atomic_ref<void*>(block.data).store(data, std::memory_order_release);
+    std::atomic_ref<std::atomic<uint32_t>*>(block.shared).store(nullptr, std::memory_order_release);
+    return data;
+}
+
+template <typename ComponentType>
+std::unique_ptr<ComponentPoolBase> ComponentPool<ComponentType>::fork() {
+    auto pool = std::make_unique<ComponentPool<ComponentType>>();
+    pool->coldTicks = coldTicks;
+    pool->mBlocks = mBlocks;
+    for(size_t blockIndex = 0; blockIndex < mBlocks.size(); ++blockIndex) {
+        auto& block = mBlocks[blockIndex];
+        if(!block.data) continue; // unallocated or compressed (the compressed data is shared by copying the block)
+        if(!block.shared) block.shared = new std::atomic<uint32_t>(1);
+        block.shared->fetch_add(1, std::memory_order_relaxed);
+        pool->mBlocks[blockIndex].shared = block.shared;
+    }
+    return pool;
+}
+
+
+// A lightweight completion handle for a (possibly asynchronous) system. It can be waited on or passed as a
+// dependency to other systems. Default constructed handles are already complete.
+// Non-ECS work (e.g. I/O) can create a pending handle and complete it itself.
+class SystemHandle {
+public:
+    SystemHandle() = default;
+
+    static SystemHandle pending();
+
+    void complete();
+    bool isDone() const;
+    void wait() const;
+    // returns whether the handle is complete
+    bool waitFor(std::chrono::microseconds timeout) const;
+
+    // func is called from the thread that completes the handle or immediately if it is already complete
+    void then(std::function<void()> func);
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        std::vector<std::function<void()>> continuations;
+    };
+    std::shared_ptr<State> mState;
+};
+
+void waitAll(const std::vector<SystemHandle>& handles);
+void whenAll(const std::vector<SystemHandle>& handles, std::function<void()> func);
+
+
+class World;
+
+// A system that may span multiple frames. It is started with World::spawn and may co_await World::nextFrame(),
+// World::access<Components...>() or a SystemHandle (e.g. a job completion). It is always resumed on a worker thread
+// of the world's WorkerPool.
+// Components may only be accessed inside an access window, which lasts from `co_await world.access<...>()` until the
+// next suspension of the coroutine. Just like tickSystem, const components are only read and others are written.
+class Coroutine {
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    struct SystemHandleAwaiter {
+        SystemHandle handle;
+
+        bool await_ready() const { return handle.isDone(); }
+        void await_suspend(Handle coroutine);
+        void await_resume() const {}
+    };
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(Handle coroutine) noexcept;
+        void await_resume() const noexcept {}
+    };
+
+    struct promise_type {
+        World* world = nullptr;
+        SystemHandle window; // running system entry of the current access window
+        SystemHandle done;
+
+        Coroutine get_return_object() { return Coroutine(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        FinalAwaiter final_suspend() const noexcept { return {}; }
+        void return_void() const {}
+        void unhandled_exception() const { std::terminate(); }
+
+        SystemHandleAwaiter await_transform(SystemHandle handle) { return SystemHandleAwaiter{handle}; }
+
+        template <typename Awaiter>
+        Awaiter&& await_transform(Awaiter&& awaiter) { return std::forward<Awaiter>(awaiter); }
+
+        void closeWindow() {
+            window.complete();
+            window = SystemHandle();
+        }
+    };
+
+    Coroutine(Coroutine&& other) : mHandle(std::exchange(other.mHandle, nullptr)) {}
+    Coroutine(const Coroutine& other) = delete;
+    Coroutine& operator=(const Coroutine& other) = delete;
+    ~Coroutine() { if(mHandle) mHandle.destroy(); }
+
+    // World::spawn takes ownership of the coroutine frame
+    Handle release() { return std::exchange(mHandle, nullptr); }
+
+private:
+    Handle mHandle;
+
+    explicit Coroutine(Handle handle) : mHandle(handle) {}
+};
+
+
+struct QueryOptions {
+    // Number of matching entities ahead of the current one, whose components are prefetched while iterating.
+    // Cursors then also prefetch the next block whenever they enter a new one. 0 disables prefetching.
+    size_t prefetchDistance = 0;
+};
+
+// A range of entities passed to the function of World::forEachChunk
+struct ColumnChunk {
+    EntityId begin;
+    // bit i is set if entity begin + i has all components of the query. Only those slots contain components.
+    uint64_t matches;
+    // One column per component of the query, in the order of their ids.
+    // The component of entity begin + i is at columns[c] + i * strides[c].
+    size_t columnCount;
+    std::array<uint8_t*, MAX_COMPONENTS> columns;
+    std::array<size_t, MAX_COMPONENTS> strides;
+};
+
+// Query filter for entities that were modified in or after the given tick (see World::getTick)
+struct ModifiedSince {
+    uint64_t tick;
+};
+
+// How long the thread(s) ticking a world waited for others (see World::getWaitStats)
+struct WaitStats {
+    uint64_t systemWaits = 0; // waits for running systems that were not done yet
+    double systemWaitSeconds = 0.0;
+    uint64_t mutexContentions = 0; // locks of the world's mutex that had to wait
+    double mutexWaitSeconds = 0.0;
+};
+
+// A mutex that counts how often and how long threads had to wait for it
+class TimedMutex {
+public:
+    void lock() {
+        if(mMutex.try_lock()) return;
+        const auto start = std::chrono::steady_clock::now();
+        mMutex.lock();
+        mContentions.fetch_add(1, std::memory_order_relaxed);
+        mWaitNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+    }
+    bool try_lock() { return mMutex.try_lock(); }
+    void unlock() { mMutex.unlock(); }
+
+    uint64_t getContentions() const { return mContentions.load(std::memory_order_relaxed); }
+    uint64_t getWaitNanoseconds() const { return mWaitNanoseconds.load(std::memory_order_relaxed); }
+    void resetStats() {
+        mContentions = 0;
+        mWaitNanoseconds = 0;
+    }
+
+private:
+    std::mutex mMutex;
+    std::atomic<uint64_t> mContentions = 0;
+    std::atomic<uint64_t> mWaitNanoseconds = 0;
+};
+
+// Tag type to pass a list of components to functions that take multiple queries
+template <typename... Components>
+struct With {};
+
 
 class EntityHandle;
 
@@ -176,11 +776,11 @@ private:
         using reference = EntityHandle&;
         using difference_type = std::ptrdiff_t;
 
-        EntityIterator() : mList(nullptr), mEntityIndex(MAX_INDEX) {} // singular iterator
+        EntityIterator() : mList(nullptr), mEntityIndex(MAX_INDEX), mMatches(0) {} // singular iterator
         EntityIterator(const EntityIterator& other) = default;
         EntityIterator& operator=(const EntityIterator& other) = default;
 
-        EntityIterator(EntityList* list, IndexType index) : mList(list), mEntityIndex(index) {}
+        EntityIterator(EntityList* list, IndexType index) : mList(list), mEntityIndex(index), mMatches(0) {}
 
         EntityIterator& operator++();
         EntityIterator operator++(int);
@@ -191,6 +791,8 @@ private:
     private:
         EntityList* mList;
         IndexType mEntityIndex;
+        // matching entities of the 64 entity word mEntityIndex is in, that come after mEntityIndex
+        uint64_t mMatches;
     };
 
     struct EntityList {
@@ -212,15 +814,53 @@ private:
     };
 
 public:
+    struct NextFrameAwaiter {
+        World& world;
+
+        bool await_ready() const { return false; }
+        void await_suspend(Coroutine::Handle coroutine);
+        void await_resume() const {}
+    };
+
+    struct AccessAwaiter {
+        World& world;
+        ComponentMask readMask;
+        ComponentMask writeMask;
+
+        bool await_ready() const { return false; }
+        void await_suspend(Coroutine::Handle coroutine);
+        void await_resume() const {}
+    };
+
+    // An entity that was migrated to another world
+    struct Migration {
+        World* world;
+        EntityId from;
+        EntityId to;
+    };
+
     World() = default;
-    ~World() = default;
+    explicit World(std::shared_ptr<WorkerPool> pool);
+    ~World();
     World(const World& other) = default;
     World& operator=(const World& other) = default;
 
     EntityHandle createEntity();
     EntityHandle getEntityHandle(EntityId entityId);
+    // Creates an entity with copies of all components of the given one. Like createEntity it is valid after flush.
+    EntityHandle cloneEntity(EntityId entityId);
+
+    // Pre-sizes the entity metadata, so creating up to entityCount entities does not reallocate
+    void reserve(size_t entityCount);
+
+    // Pre-sizes the block table of the component pool for entity ids < entityCount. If allocateBlocks is true,
+    // the blocks are allocated too, so that adding the components does not allocate.
+    template <typename ComponentType>
+    void reserve(size_t entityCount, bool allocateBlocks = false);
 
     void destroyEntity(EntityId entityId);
+    // Destroys all entities, removing their components pool by pool
+    void destroyEntities(const std::vector<EntityId>& entities);
 
     template <typename ComponentType, typename... Args>
     ComponentType& addComponent(EntityId entityId, Args&&... args);
@@ -239,56 +879,293 @@ public:
     void removeComponent(EntityId entityId);
 
     bool isValid(EntityId entityId) const {
-        assert(entityId < mEntityValid.size());
-        return mEntityValid[entityId];
+        assert(entityId < mComponentMasks.size());
+        return (mEntityValid[entityId / 64] >> (entityId % 64)) & 1;
     }
 
     template <typename... Components, typename... FuncArgs, typename FuncType>
-    void tickSystem(bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs);
+    SystemHandle tickSystem(bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs);
+
+    // Only ticks the entities that were modified since the given tick, e.g. to write the changes to a database.
+    // Ranges of 64 entities that were not modified are skipped without looking at the entities.
+    template <typename... Components, typename... FuncArgs, typename FuncType>
+    SystemHandle tickSystem(ModifiedSince filter, bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs);
+
+    // For code that only knows the components at runtime (scripts, debug tools). Calls func(const ColumnChunk&) for
+    // every chunk of up to 64 entities (less if the block size of a component is smaller) containing at least one
+    // entity that has all components in readMask | writeMask, with pointers to the components of the chunk.
+    // Like a synchronous system it waits for other systems writing to (or reading from writeMask) these components.
+    // func must not add or remove components or entities.
+    SystemHandle forEachChunk(ComponentMask readMask, ComponentMask writeMask, bool parallelFor,
+                              const std::function<void(const ColumnChunk&)>& func);
+
+    // Same as tickSystem, but the tick function will not start before all dependencies are complete.
+    // These are waited for in addition to the systems that write to components this system accesses.
+    template <typename... Components, typename... FuncArgs, typename FuncType>
+    SystemHandle tickSystemAfter(const std::vector<SystemHandle>& dependencies, bool async, bool parallelFor,
+                                 FuncType tickFunc, FuncArgs&&... funcArgs);
 
     void joinSystemThreads();
     void flush(EntityId entityId);
     void flush(); // flush all
 
     void finishTick() {
-        joinSystemThreads();
+        // coroutines that were waiting for something else might want to start systems meanwhile, they have to wait
+        auto window = stopSystems();
         flush();
+        mTick++;
+        if(mProfiler) mProfiler->finishFrame();
+        window.complete();
+        resumeNextFrameCoroutines();
+    }
+
+    // Number of finished ticks
+    uint64_t getTick() const { return mTick.load(std::memory_order_relaxed); }
+
+    // The last tick in which a mutable reference to one of the entity's components was handed out (by a system with
+    // a non-const component or a non-const getComponent) or a component was added or removed. Destroying an entity
+    // or migrating it away counts as removing its components (and migrating it in as adding them).
+    uint64_t getModifiedTick(EntityId entityId) const {
+        assert(entityId < mModifiedTicks.size());
+        return std::atomic_ref<uint64_t>(const_cast<uint64_t&>(mModifiedTicks[entityId])).load(std::memory_order_relaxed);
+    }
+
+    // Moves the entities with all their components to dst and returns their new ids in dst (in the same order).
+    // The components are moved pool by pool for the whole batch. Waits until no system or coroutine in either world
+    // accesses any components, so call this between ticks. The new entities are flushed already.
+    std::vector<EntityId> migrate(const std::vector<EntityId>& entities, World& dst);
+
+    // Can be called from systems, the entity is migrated by the next call to migrateQueued
+    void queueMigration(EntityId entityId, World& dst);
+    // Migrates all queued entities in one batch per destination world (see migrate)
+    std::vector<Migration> migrateQueued();
+
+    // For migration to a world in another process: appends the given components of the entities to data. Only the
+    // listed components are written and they are copied bytewise, so they have to be trivially copyable.
+    template <typename... Components>
+    void serialize(const std::vector<EntityId>& entities, std::vector<uint8_t>& data);
+
+    // Creates (and flushes) entities from data written by serialize with the same components and returns their ids.
+    // Returns std::nullopt without creating any entities if data is truncated or corrupt (e.g. a damaged file).
+    template <typename... Components>
+    std::optional<std::vector<EntityId>> deserialize(const uint8_t* data, size_t size);
+
+    // The returned handle is complete when the coroutine has finished.
+    // All spawned coroutines must be finished or waiting for the next frame when the world is destroyed.
+    SystemHandle spawn(Coroutine coroutine);
+
+    // Coroutines waiting for the next frame are resumed at the end of World::finishTick
+    NextFrameAwaiter nextFrame() { return NextFrameAwaiter{*this}; }
+
+    template <typename... Components>
+    AccessAwaiter access() {
+        return AccessAwaiter{*this, constFilteredComponentMask<true, Components...>(),
+            constFilteredComponentMask<false, Components...>()};
     }
 
+    // Memory of unused component blocks that is kept for reuse. Blocks exceeding this are freed on the worker pool,
+    // so that destroying lots of entities doesn't stall the thread calling finishTick.
+    void setMaxRetainedBlockMemory(size_t bytes);
+
+    // Blocks of the component's pool that were not accessed for the given number of ticks are compressed in
+    // finishTick and decompressed again by the first access. 0 (the default) disables compression.
+    template <typename ComponentType>
+    void setColdCompression(size_t ticks);
+    size_t getRetainedBlockMemory() const;
+
+    // Time spent waiting for other systems (to start a system or in finishTick) and for the world's mutex,
+    // summed over all threads. Useful to see how well systems scale with more threads.
+    WaitStats getWaitStats() const;
+    void resetWaitStats();
+
+    void setWorkerPool(std::shared_ptr<WorkerPool> pool);
+    WorkerPool& getWorkerPool() const { return *mWorkerPool; }
+    const std::shared_ptr<WorkerPool>& getSharedWorkerPool() const { return mWorkerPool; }
+
+    // Measures the time and hardware counters of every tickSystem (see perfcounters.hpp), nullptr to stop.
+    // Profilers can be shared between worlds, systems with the same name are added up.
+    void setProfiler(std::shared_ptr<SystemProfiler> profiler) { mProfiler = std::move(profiler); }
+    const std::shared_ptr<SystemProfiler>& getProfiler() const { return mProfiler; }
+    const ThreadConfig& getThreadConfig() const { return mWorkerPool->getConfig(); }
+
     auto getEntityCount() const { return mComponentMasks.size(); }
 
     // https://stackoverflow.com/questions/41331215/what-are-the-constraints-on-the-user-using-stls-parallel-algorithms
     template <typename... Components, typename FuncType, typename ExPo>
     void forEachEntity(FuncType func, ExPo executionPolicy = std::execution::seq);
 
+    // Maps every entity with the given components to a value and combines them with combineFunc. mapFunc gets the
+    // components (and optionally an EntityHandle first), like a tick function.
+    // Entities are reduced in chunks of WorkerPool::CHUNK_SIZE, whose results are combined in order, so the result
+    // does not depend on the execution policy or the number of threads, even if combineFunc is not associative
+    // (like floating point addition). Waits for running systems that write to the components.
+    template <typename... Components, typename T, typename MapFunc, typename CombineFunc,
+              typename ExPo = const std::execution::sequenced_policy&>
+    T reduce(T identity, MapFunc mapFunc, CombineFunc combineFunc, ExPo&& executionPolicy = std::execution::seq);
+
+    // Calls func(a, b, output) for every unordered pair of distinct entities that have the given components, which
+    // may only be accessed read-only. The second overload calls it for every pair of an entity from the first and an
+    // entity from the second query instead.
+    // The pairs are partitioned into tiles which are processed in parallel on the worker pool for std::execution::par
+    // (other policies are passed on to std::for_each over the tiles). Every tile has its
+    // own output buffer (a std::vector<Output>) and they are concatenated in tile order. The tiles only depend on the
+    // number of entities, so the output does not depend on the execution policy or the number of threads.
+    template <typename Output, typename... Components, typename FuncType,
+              typename ExPo = const std::execution::sequenced_policy&>
+    std::vector<Output> forEachPair(With<Components...> query, FuncType func,
+                                    ExPo&& executionPolicy = std::execution::seq);
+
+    template <typename Output, typename... ComponentsA, typename... ComponentsB, typename FuncType,
+              typename ExPo = const std::execution::sequenced_policy&>
+    std::vector<Output> forEachPair(With<ComponentsA...> queryA, With<ComponentsB...> queryB, FuncType func,
+                                    ExPo&& executionPolicy = std::execution::seq);
+
+    // Returns a copy of the world, which shares all component blocks with this one. A block is only copied when
+    // either world writes to it, so forking (and discarding the fork) is cheap, e.g. to simulate a few ticks ahead.
+    // Waits for systems writing to any components, so preferably call this between ticks.
+    // Throws std::logic_error if a component type in the world is not copy constructible.
+    std::unique_ptr<World> fork();
+
+    // Options for systems iterating exactly these components (constness does not matter)
+    template <typename... Components>
+    void setQueryOptions(const QueryOptions& options) { mQueryOptions[componentMask<Components...>()] = options; }
+
+    template <typename... Components>
+    QueryOptions getQueryOptions() const {
+        const auto it = mQueryOptions.find(componentMask<Components...>());
+        return it != mQueryOptions.end() ? it->second : mDefaultQueryOptions;
+    }
+
+    // Used for all queries without options of their own
+    void setDefaultQueryOptions(const QueryOptions& options) { mDefaultQueryOptions = options; }
+
     template <typename... Components>
     EntityList entitiesWith() {
         return EntityList(*this, componentMask<Components...>());
     }
 
 private:
+    friend struct Coroutine::SystemHandleAwaiter;
+
     struct RunningSystem {
         ComponentMask readMask;
         ComponentMask writeMask;
-        std::thread thread;
-        bool threadJoined;
+        SystemHandle handle;
 
         RunningSystem(ComponentMask readMask, ComponentMask writeMask) :
-            readMask(readMask), writeMask(writeMask), threadJoined(false) {}
+            readMask(readMask), writeMask(writeMask), handle(SystemHandle::pending()) {}
+    };
+
+    // Synchronous systems are done before tickSystem returns, so they don't need a RunningSystem. The handle is only
+    // created when another thread has to wait for one (e.g. a coroutine), so ticking them doesn't allocate.
+    struct SyncSystem {
+        ComponentMask readMask;
+        ComponentMask writeMask;
+        std::thread::id thread;
+        std::optional<SystemHandle> handle;
     };
 
     std::vector<ComponentMask> mComponentMasks;
-    std::vector<bool> mEntityValid;
+    // bitmap with one bit per entity, so it can be scanned together with the component masks
+    std::vector<uint64_t> mEntityValid;
+    // per entity and the maximum of every 64 entities (like mEntityValid), so ModifiedSince can skip whole words
+    std::vector<uint64_t> mModifiedTicks;
+    std::vector<uint64_t> mModifiedTickMaxima;
+    std::atomic<uint64_t> mTick = 0;
+    std::shared_ptr<SystemProfiler> mProfiler;
     // the free list is a min heap, so that we try to fill lower indices first
     std::priority_queue<EntityId, std::vector<EntityId>, std::greater<>> mEntityIdFreeList;
     std::vector<std::unique_ptr<RunningSystem>> mRunningSystems;
+    std::vector<SyncSystem> mSyncSystems;
+    std::vector<Coroutine::Handle> mNextFrameCoroutines;
     std::array<std::unique_ptr<ComponentPoolBase>, MAX_COMPONENTS> mPools;
-    mutable std::mutex mMutex;
+    std::shared_ptr<WorkerPool> mWorkerPool = WorkerPool::getDefault();
+    std::unordered_map<ComponentMask, QueryOptions> mQueryOptions;
+    QueryOptions mDefaultQueryOptions;
+    std::atomic<uint64_t> mEpoch = 0;
+    BlockRecycling mBlockRecycling; // protected by mMutex
+    std::vector<std::pair<EntityId, World*>> mMigrationQueue; // protected by mMutex
+    mutable TimedMutex mMutex;
+    std::atomic<uint64_t> mSystemWaits = 0;
+    std::atomic<uint64_t> mSystemWaitNanoseconds = 0;
+    // Coroutines register running systems from worker threads, so these need their own mutex
+    std::mutex mSystemsMutex;
 
     template <typename ComponentType>
     ComponentPool<ComponentType>& getPool(bool alloc = true);
+    void initPool(ComponentPoolBase& pool);
+
+    // mMutex has to be locked
+    EntityId createEntityId();
+
+    template <typename FuncType>
+    void forEachEntityInRange(ComponentMask mask, size_t begin, size_t end, FuncType&& func) {
+        forEachEntityInRange(mask, begin, end, std::forward<FuncType>(func), 0, [](EntityId) {});
+    }
+
+    // prefetchFunc is called with the entity that is prefetchDistance matches ahead of the one passed to func.
+    // If modifiedSince is set, only entities modified in or after that tick are visited.
+    template <typename FuncType, typename PrefetchFuncType>
+    void forEachEntityInRange(ComponentMask mask, size_t begin, size_t end, FuncType&& func,
+                              size_t prefetchDistance, PrefetchFuncType&& prefetchFunc,
+                              std::optional<uint64_t> modifiedSince = std::nullopt);
+
+    template <typename... Components, typename FuncType, typename ArgsTuple, size_t... ArgIndices>
+    void tickEntities(size_t begin, size_t end, const QueryOptions& options, std::optional<uint64_t> modifiedSince,
+                      FuncType& tickFunc, ArgsTuple& args, std::index_sequence<ArgIndices...>);
 
-    void waitForSystems(ComponentMask readMask, ComponentMask writeMask);
+    template <typename... Components, typename... FuncArgs, typename FuncType>
+    SystemHandle tickSystemImpl(const std::vector<SystemHandle>& dependencies, std::optional<uint64_t> modifiedSince,
+                                bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs);
+
+    void markModified(EntityId entityId, uint64_t tick) {
+        // relaxed atomics, since getComponent might mark the same entity from different threads
+        std::atomic_ref<uint64_t> modified(mModifiedTicks[entityId]);
+        if(modified.load(std::memory_order_relaxed) != tick) modified.store(tick, std::memory_order_relaxed);
+        std::atomic_ref<uint64_t> maximum(mModifiedTickMaxima[entityId / 64]);
+        if(maximum.load(std::memory_order_relaxed) < tick) maximum.store(tick, std::memory_order_relaxed);
+    }
+
+    std::vector<EntityId> getMatchingEntities(ComponentMask mask);
+
+    // Lists of entities are split into at most this many segments of at least the minimum size. The tiles only depend
+    // on the number of entities, so that the output of forEachPair doesn't depend on the number of threads.
+    static constexpr size_t MAX_PAIR_SEGMENTS = 32;
+    static constexpr size_t MIN_PAIR_SEGMENT_SIZE = 64;
+
+    static size_t getPairSegmentSize(size_t entityCount) {
+        return std::max((entityCount + MAX_PAIR_SEGMENTS - 1) / MAX_PAIR_SEGMENTS, MIN_PAIR_SEGMENT_SIZE);
+    }
+
+    // tiles are (first, second) ranges in the lists of entities
+    struct PairTile {
+        size_t beginA, endA, beginB, endB;
+        bool triangular; // same range in the same list, so only visit i < j
+    };
+
+    template <typename Output, typename FuncType, typename ExPo>
+    std::vector<Output> forEachPairInTiles(const std::vector<EntityId>& listA,
+        const std::vector<EntityId>& listB, const std::vector<PairTile>& tiles, FuncType& func, ExPo&& executionPolicy);
+
+    // Registers a running system and appends the handles of the running systems it conflicts with to dependencies.
+    // Only the thread calling tickSystem may touch the returned RunningSystem after this.
+    RunningSystem& startSystem(ComponentMask readMask, ComponentMask writeMask, std::vector<SystemHandle>& dependencies);
+    // Like startSystem, but for a system that runs on the calling thread until finishSyncSystem
+    void startSyncSystem(ComponentMask readMask, ComponentMask writeMask, std::vector<SystemHandle>& dependencies);
+    void finishSyncSystem();
+    // mSystemsMutex has to be locked
+    void addConflicts(ComponentMask readMask, ComponentMask writeMask, std::vector<SystemHandle>& dependencies);
+    // Removes the systems that are done. Only call from the thread calling tickSystem
+    void joinFinishedSystems();
+    // If called from a worker (e.g. a world stepped by a Runtime), this runs jobs of this world while waiting
+    void waitForSystems(const std::vector<SystemHandle>& systems);
+    // Waits until no systems are running anymore, reclaims and compresses blocks and returns the handle of a system
+    // that writes to everything, so that systems started in the meantime wait until it is completed.
+    SystemHandle stopSystems();
+
+    void scheduleCoroutine(Coroutine::Handle coroutine, ComponentMask readMask, ComponentMask writeMask,
+                           std::vector<SystemHandle> dependencies, bool registerNow);
+    void resumeNextFrameCoroutines();
 };
 
 
@@ -329,6 +1206,7 @@ private:
 
     friend EntityHandle World::createEntity();
     friend EntityHandle World::getEntityHandle(EntityId);
+    friend EntityHandle World::cloneEntity(EntityId);
 };
 
 // Implementation
@@ -339,17 +1217,32 @@ ComponentPool<ComponentType>& World::getPool(bool alloc) {
     assert(compId < mPools.size());
     if(alloc && !mPools[compId]) {
         mPools[compId] = std::make_unique<ComponentPool<ComponentType>>();
+        initPool(*mPools[compId]);
     }
     assert(mPools[compId]);
     return *static_cast<ComponentPool<ComponentType>*>(mPools[compId].get());
 }
 
+template <typename ComponentType>
+void World::setColdCompression(size_t ticks) {
+    static_assert(std::is_trivially_copyable<ComponentType>::value, "Only trivially copyable components can be compressed");
+    std::lock_guard lock(mMutex);
+    getPool<ComponentType>().coldTicks = ticks;
+}
+
+template <typename ComponentType>
+void World::reserve(size_t entityCount, bool allocateBlocks) {
+    std::lock_guard lock(mMutex);
+    getPool<ComponentType>().reserve(entityCount, allocateBlocks);
+}
+
 template <typename ComponentType, typename... Args>
 ComponentType& World::addComponent(EntityId entityId, Args&&... args) {
     std::lock_guard lock(mMutex);
     assert(mComponentMasks.size() > entityId);
     assert(!hasComponents<ComponentType>(entityId));
     mComponentMasks[entityId] |= componentMask<ComponentType>();
+    markModified(entityId, getTick());
     return getPool<ComponentType>().add(entityId, std::forward<Args>(args)...);
 }
 
@@ -364,27 +1257,95 @@ ComponentType& World::getComponent(EntityId entityId) {
     // make getPool not alloc, so we don't have to protect getComponent with the mutex
     // this should never trigger an allocation anyways, since we assert hasComponent above,
     // so this is just an extra safety measure
-    return getPool<typename std::remove_const<ComponentType>::type>(false).get(entityId);
+    if constexpr(!std::is_const<ComponentType>::value) markModified(entityId, getTick());
+    return getPool<typename std::remove_const<ComponentType>::type>(false).get(entityId, !std::is_const<ComponentType>::value);
 }
 
 template <typename ComponentType>
 void World::removeComponent(EntityId entityId) {
     std::lock_guard lock(mMutex);
+    assert(mComponentMasks.size() > entityId);
+    mComponentMasks[entityId] &= ~componentMask<ComponentType>();
+    markModified(entityId, getTick());
     getPool<ComponentType>().remove(entityId);
 }
 
-template <bool isConst, typename ComponentType>
-ComponentMask _constFilteredComponentMask() {
-    if constexpr(std::is_const<ComponentType>::value == isConst) {
-        return componentMask<ComponentType>();
-    } else {
-        return 0;
+template <typename FuncType, typename PrefetchFuncType>
+void World::forEachEntityInRange(ComponentMask mask, size_t begin, size_t end, FuncType&& func,
+                                 size_t prefetchDistance, PrefetchFuncType&& prefetchFunc,
+                                 std::optional<uint64_t> modifiedSince) {
+    // scan the masks in pieces (starting at a multiple of 64) into a bitmap of matching entities and visit those
+    static const size_t PIECE_SIZE = 1024;
+    uint64_t matches[PIECE_SIZE / 64];
+    for(auto pieceBegin = begin / 64 * 64; pieceBegin < end; pieceBegin += PIECE_SIZE) {
+        const auto pieceEnd = std::min(end, pieceBegin + PIECE_SIZE);
+        const auto words = (pieceEnd - pieceBegin + 63) / 64;
+        scanMasks(mComponentMasks.data() + pieceBegin, mEntityValid.data() + pieceBegin / 64, pieceEnd - pieceBegin,
+            mask, matches);
+        if(pieceBegin < begin) matches[0] &= ~uint64_t(0) << (begin - pieceBegin);
+        if(modifiedSince) {
+            for(size_t word = 0; word < words; ++word) {
+                if(!matches[word]) continue;
+                const auto w = pieceBegin / 64 + word;
+                if(std::atomic_ref<uint64_t>(mModifiedTickMaxima[w]).load(std::memory_order_relaxed) < *modifiedSince) {
+                    matches[word] = 0;
+                    continue;
+                }
+                for(auto bits = matches[word]; bits; bits &= bits - 1) {
+                    const auto bit = std::countr_zero(bits);
+                    if(getModifiedTick(pieceBegin + word * 64 + bit) < *modifiedSince) matches[word] &= ~(uint64_t(1) << bit);
+                }
+            }
+        }
+
+        // a second pass over the bitmap that runs prefetchDistance matches ahead
+        size_t aheadWord = 0;
+        uint64_t aheadBits = matches[0];
+        auto prefetchNext = [&]() {
+            while(!aheadBits && ++aheadWord < words) aheadBits = matches[aheadWord];
+            if(!aheadBits) return;
+            prefetchFunc(pieceBegin + aheadWord * 64 + std::countr_zero(aheadBits));
+            aheadBits &= aheadBits - 1;
+        };
+        for(size_t i = 0; i < prefetchDistance; ++i) prefetchNext();
+
+        for(size_t word = 0; word < words; ++word) {
+            for(auto bits = matches[word]; bits; bits &= bits - 1) {
+                if(prefetchDistance > 0) prefetchNext();
+                const auto entityId = pieceBegin + word * 64 + std::countr_zero(bits);
+                // func might have destroyed entities since the piece was scanned
+                if(isValid(entityId) && hasComponents(entityId, mask)) func(getEntityHandle(entityId));
+            }
+        }
     }
 }
 
-template <bool isConst, typename... Args>
-ComponentMask constFilteredComponentMask() {
-    return (... | _constFilteredComponentMask<isConst, Args>());
+template <typename... Components, typename FuncType, typename ArgsTuple, size_t... ArgIndices>
+void World::tickEntities(size_t begin, size_t end, const QueryOptions& options, std::optional<uint64_t> modifiedSince,
+                         FuncType& tickFunc, ArgsTuple& args, std::index_sequence<ArgIndices...>) {
+    // if one of the pools doesn't exist, no entity can have all components
+    if(!(... && mPools[componentId::get<typename std::remove_const<Components>::type>()])) return;
+    static constexpr auto mutating = (... || !std::is_const<Components>::value);
+    const auto tick = getTick();
+
+    // One cursor per component, which only looks up the block pointer again when we cross a block boundary
+    const auto prefetch = options.prefetchDistance > 0;
+    auto cursors = std::make_tuple(getPool<typename std::remove_const<Components>::type>(false).getCursor(prefetch,
+        !std::is_const<Components>::value)...);
+    auto prefetchFunc = [&cursors](EntityId id) {
+        (..., std::get<typename ComponentPool<typename std::remove_const<Components>::type>::Cursor>(cursors).prefetch(id));
+    };
+    forEachEntityInRange(componentMask<Components...>(), begin, end, [&](EntityHandle e) {
+        const auto id = e.getId();
+        if constexpr(mutating) markModified(id, tick);
+        if constexpr(std::is_invocable_r<void, FuncType, EntityHandle, std::tuple_element_t<ArgIndices, ArgsTuple>&..., Components&...>::value) {
+            tickFunc(e, std::get<ArgIndices>(args)...,
+                std::get<typename ComponentPool<typename std::remove_const<Components>::type>::Cursor>(cursors).get(id)...);
+        } else {
+            tickFunc(std::get<ArgIndices>(args)...,
+                std::get<typename ComponentPool<typename std::remove_const<Components>::type>::Cursor>(cursors).get(id)...);
+        }
+    }, options.prefetchDistance, prefetchFunc, modifiedSince);
 }
 
 template <typename... Components, typename FuncType, typename ExPo>
@@ -392,58 +1353,299 @@ void World::forEachEntity(FuncType func, ExPo executionPolicy) {
     // EntityHandle has to be passed by value to the invokable, because the EntityHandle returned from the EntityIterator
     // is a temporary, since they are not stored somewhere, but merely handles.
     static_assert(std::is_invocable_r<void, FuncType, EntityHandle>::value);
-    auto entityList = entitiesWith<Components...>();
-    std::for_each(executionPolicy, entityList.begin(), entityList.end(), func);
+    if constexpr(std::is_same<std::decay_t<ExPo>, std::execution::parallel_policy>::value) {
+        // Use our own worker pool instead of the standard library's, so we control where and on how many threads
+        // this runs and chunks are processed on the NUMA node that owns them.
+        const auto mask = componentMask<Components...>();
+        mWorkerPool->parallelFor(getEntityCount(), [this, mask, &func](size_t begin, size_t end) {
+            forEachEntityInRange(mask, begin, end, func);
+        });
+    } else {
+        auto entityList = entitiesWith<Components...>();
+        std::for_each(executionPolicy, entityList.begin(), entityList.end(), func);
+    }
 }
 
 template <typename... Components, typename... FuncArgs, typename FuncType>
-void World::tickSystem(bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs) {
+SystemHandle World::tickSystem(bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs) {
+    return tickSystemAfter<Components...>({}, async, parallelFor, tickFunc, std::forward<FuncArgs>(funcArgs)...);
+}
+
+template <typename... Components, typename... FuncArgs, typename FuncType>
+SystemHandle World::tickSystem(ModifiedSince filter, bool async, bool parallelFor, FuncType tickFunc,
+                               FuncArgs&&... funcArgs) {
+    return tickSystemImpl<Components...>({}, filter.tick, async, parallelFor, tickFunc,
+        std::forward<FuncArgs>(funcArgs)...);
+}
+
+template <typename... Components, typename... FuncArgs, typename FuncType>
+SystemHandle World::tickSystemAfter(const std::vector<SystemHandle>& dependencies, bool async, bool parallelFor,
+                                    FuncType tickFunc, FuncArgs&&... funcArgs) {
+    return tickSystemImpl<Components...>(dependencies, std::nullopt, async, parallelFor, tickFunc,
+        std::forward<FuncArgs>(funcArgs)...);
+}
+
+template <typename... Components, typename... FuncArgs, typename FuncType>
+SystemHandle World::tickSystemImpl(const std::vector<SystemHandle>& dependencies, std::optional<uint64_t> modifiedSince,
+                                   bool async, bool parallelFor, FuncType tickFunc, FuncArgs&&... funcArgs) {
     static_assert(!(... || std::is_reference<Components>::value), "Component types must not be references");
-    static constexpr auto funcValid = std::is_invocable_r<void, FuncType, FuncArgs..., Components&...>::value;
-    static constexpr auto funcValidWithEntityHandle = std::is_invocable_r<void, FuncType, EntityHandle, FuncArgs..., Components&...>::value;
+    static constexpr auto funcValid = std::is_invocable_r<void, FuncType, FuncArgs&..., Components&...>::value;
+    static constexpr auto funcValidWithEntityHandle = std::is_invocable_r<void, FuncType, EntityHandle, FuncArgs&..., Components&...>::value;
     static_assert(funcValid || funcValidWithEntityHandle, "Tick function has invalid signature");
 
     const auto readMask = constFilteredComponentMask<true, Components...>();
     const auto writeMask = constFilteredComponentMask<false, Components...>();
     assert((readMask | writeMask) == componentMask<Components...>());
-    waitForSystems(readMask, writeMask);
 
+    // With a profiler every part of the system is measured on the thread that runs it
+    SystemProfiler::Counters* counters = nullptr;
+    if(mProfiler) {
+        counters = &mProfiler->getCounters(getSystemName(tickFunc));
+        counters->invocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    // starting the system counts as well
+    AllocationScope allocations(counters ? &counters->allocations : nullptr);
+
+    joinFinishedSystems();
+    auto waitFor = dependencies;
+
+    // Arguments passed as lvalues are stored as references, temporaries are copied, so they live as long as the
+    // (possibly asynchronous) system.
     // When you use `if constexpr` in lambdas, MSVC will just roll over dead and do all kinds of crazy things (gcc and clang are fine though)
-    // therefore I need to use std::function here. When this is fixed, I can just move the if constexpr into the lambda.
-    // It seems a simplified version of this generates the same code on clang and way slower code on gcc (https://godbolt.org/z/QAhhx8)
-    // On MSVC I can not measure any performance difference to before adding the `funcValidWithEntityHandle` feature.
-    std::function<void(EntityHandle)> tickEntity;
-    if constexpr(funcValidWithEntityHandle) {
-        tickEntity = [tickFunc, &funcArgs...](EntityHandle e) {
-            tickFunc(e, std::forward<FuncArgs>(funcArgs)..., e.get<Components>()...);
+    // therefore the loop over the entities lives in tickEntities, which is a regular member function template.
+    auto tickAll = [this, parallelFor, modifiedSince, tickFunc, options = getQueryOptions<Components...>(),
+                    profiler = mProfiler, counters,
+                    args = std::tuple<FuncArgs...>(std::forward<FuncArgs>(funcArgs)...)]() mutable {
+        auto tickRange = [&, this](size_t begin, size_t end) {
+            tickEntities<Components...>(begin, end, options, modifiedSince, tickFunc, args,
+                std::index_sequence_for<FuncArgs...>());
         };
-    } else {
-        tickEntity = [tickFunc, &funcArgs...](EntityHandle e) {
-            tickFunc(std::forward<FuncArgs>(funcArgs)..., e.get<Components>()...);
+        auto measuredTickRange = [&](size_t begin, size_t end) {
+            if(counters) {
+                SystemProfiler::measure(*counters, [&]() { tickRange(begin, end); });
+            } else {
+                tickRange(begin, end);
+            }
         };
-    }
-
-    auto tickAll = [this, parallelFor, tickEntity]() {
         if(parallelFor) {
-            forEachEntity<Components...>(tickEntity, std::execution::par);
+            mWorkerPool->parallelFor(getEntityCount(), measuredTickRange);
         } else {
-            forEachEntity<Components...>(tickEntity, std::execution::seq);
+            measuredTickRange(0, getEntityCount());
         }
     };
 
     if (async) {
-        auto system = std::make_unique<RunningSystem>(readMask, writeMask);
-        system->thread = std::thread(tickAll);
+        auto handle = startSystem(readMask, writeMask, waitFor).handle;
+        // The system is a job of the pool like everything else, so async systems don't need threads of their own.
+        // It is only submitted when the dependencies are done, so it doesn't block a worker while waiting.
+        whenAll(waitFor, [this, pool = mWorkerPool, tickAll, handle]() {
+            pool->submit([tickAll, handle]() mutable {
+                tickAll();
+                handle.complete();
+            }, this);
+        });
+        return handle;
+    } else {
+        startSyncSystem(readMask, writeMask, waitFor);
+        waitForSystems(waitFor);
+        tickAll();
+        finishSyncSystem();
+        return SystemHandle(); // already complete
+    }
+}
 
-        // I could make the lambda above a member function of World and do something like the following,
-        // but that would only compile in gcc and not msvc, so I use the lambda instead
-        //void (World::*threadFunc)(RunningSystem*, FuncType, FuncArgs...) = &systemThreadFunction<Components..., FuncArgs..., FuncType>;
-        //system->thread = std::thread(threadFunc, this, system, tickFunc, funcArgs...);
+template <typename... Components, typename T, typename MapFunc, typename CombineFunc, typename ExPo>
+T World::reduce(T identity, MapFunc mapFunc, CombineFunc combineFunc, ExPo&& executionPolicy) {
+    static_assert(!(... || std::is_reference<Components>::value), "Component types must not be references");
+    static constexpr auto mapValid = std::is_invocable_r<T, MapFunc, Components&...>::value;
+    static constexpr auto mapValidWithEntityHandle = std::is_invocable_r<T, MapFunc, EntityHandle, Components&...>::value;
+    static_assert(mapValid || mapValidWithEntityHandle, "Map function has invalid signature");
+    static_assert(std::is_invocable_r<T, CombineFunc, T, T>::value, "Combine function has invalid signature");
+
+    joinFinishedSystems();
+    std::vector<SystemHandle> waitFor;
+    auto handle = startSystem(constFilteredComponentMask<true, Components...>(),
+        constFilteredComponentMask<false, Components...>(), waitFor).handle;
+    waitForSystems(waitFor);
+
+    const auto mask = componentMask<Components...>();
+    const auto entityCount = getEntityCount();
+    std::vector<T> partials((entityCount + WorkerPool::CHUNK_SIZE - 1) / WorkerPool::CHUNK_SIZE, identity);
+    auto reduceChunk = [&](size_t begin, size_t end) {
+        auto& partial = partials[begin / WorkerPool::CHUNK_SIZE];
+        forEachEntityInRange(mask, begin, end, [&](EntityHandle e) {
+            if constexpr(mapValidWithEntityHandle) {
+                partial = combineFunc(std::move(partial), mapFunc(e, e.get<Components>()...));
+            } else {
+                partial = combineFunc(std::move(partial), mapFunc(e.get<Components>()...));
+            }
+        });
+    };
 
-        mRunningSystems.emplace_back(std::move(system));
+    if constexpr(std::is_same<std::decay_t<ExPo>, std::execution::parallel_policy>::value) {
+        mWorkerPool->parallelFor(entityCount, reduceChunk);
     } else {
-        tickAll();
+        for(size_t begin = 0; begin < entityCount; begin += WorkerPool::CHUNK_SIZE) {
+            reduceChunk(begin, std::min(entityCount, begin + WorkerPool::CHUNK_SIZE));
+        }
+    }
+    handle.complete();
+
+    auto result = std::move(identity);
+    for(auto& partial : partials) result = combineFunc(std::move(result), std::move(partial));
+    return result;
+}
+
+template <typename Output, typename FuncType, typename ExPo>
+std::vector<Output> World::forEachPairInTiles(const std::vector<EntityId>& listA,
+        const std::vector<EntityId>& listB, const std::vector<PairTile>& tiles, FuncType& func, ExPo&& executionPolicy) {
+    static_assert(std::is_invocable_r<void, FuncType, EntityHandle, EntityHandle, std::vector<Output>&>::value,
+        "Pair function has invalid signature");
+    std::vector<std::vector<Output>> outputs(tiles.size());
+    auto processTiles = [&](size_t begin, size_t end) {
+        for(auto t = begin; t < end; ++t) {
+            const auto& tile = tiles[t];
+            for(auto i = tile.beginA; i < tile.endA; ++i) {
+                for(auto j = tile.triangular ? i + 1 : tile.beginB; j < tile.endB; ++j) {
+                    func(getEntityHandle(listA[i]), getEntityHandle(listB[j]), outputs[t]);
+                }
+            }
+        }
+    };
+    // par runs on our own worker pool (like forEachEntity), the other policies are passed on to the standard library.
+    // Every tile has its own output either way, so the result is the same.
+    if constexpr(std::is_same<std::decay_t<ExPo>, std::execution::parallel_policy>::value) {
+        mWorkerPool->parallelFor(tiles.size(), 1, processTiles);
+    } else {
+        std::for_each(std::forward<ExPo>(executionPolicy), tiles.begin(), tiles.end(), [&](const PairTile& tile) {
+            const auto t = static_cast<size_t>(&tile - tiles.data());
+            processTiles(t, t + 1);
+        });
+    }
+
+    std::vector<Output> output;
+    for(auto& tileOutput : outputs) {
+        output.insert(output.end(), std::make_move_iterator(tileOutput.begin()), std::make_move_iterator(tileOutput.end()));
+    }
+    return output;
+}
+
+template <typename Output, typename... Components, typename FuncType, typename ExPo>
+std::vector<Output> World::forEachPair(With<Components...>, FuncType func, ExPo&& executionPolicy) {
+    static_assert((... && std::is_const<Components>::value), "Components in pair iteration must be const");
+    joinFinishedSystems();
+    std::vector<SystemHandle> waitFor;
+    const auto readMask = componentMask<Components...>();
+    auto handle = startSystem(readMask, 0, waitFor).handle;
+    waitForSystems(waitFor);
+
+    // Split the list into n segments, so that there are n * (n + 1) / 2 tiles, enough for every worker to get a few.
+    // The tiles on the diagonal only contain half as many pairs, but they are few enough not to matter.
+    const auto entities = getMatchingEntities(readMask);
+    const auto segmentSize = getPairSegmentSize(entities.size());
+    std::vector<PairTile> tiles;
+    for(size_t a = 0; a < entities.size(); a += segmentSize) {
+        for(size_t b = a; b < entities.size(); b += segmentSize) {
+            tiles.push_back(PairTile{a, std::min(a + segmentSize, entities.size()),
+                b, std::min(b + segmentSize, entities.size()), a == b});
+        }
+    }
+
+    auto output = forEachPairInTiles<Output>(entities, entities, tiles, func, executionPolicy);
+    handle.complete();
+    return output;
+}
+
+template <typename Output, typename... ComponentsA, typename... ComponentsB, typename FuncType, typename ExPo>
+std::vector<Output> World::forEachPair(With<ComponentsA...>, With<ComponentsB...>, FuncType func, ExPo&& executionPolicy) {
+    static_assert((... && std::is_const<ComponentsA>::value) && (... && std::is_const<ComponentsB>::value),
+        "Components in pair iteration must be const");
+    joinFinishedSystems();
+    std::vector<SystemHandle> waitFor;
+    const auto maskA = componentMask<ComponentsA...>(), maskB = componentMask<ComponentsB...>();
+    auto handle = startSystem(maskA | maskB, 0, waitFor).handle;
+    waitForSystems(waitFor);
+
+    const auto entitiesA = getMatchingEntities(maskA), entitiesB = getMatchingEntities(maskB);
+    const auto segmentSizeA = getPairSegmentSize(entitiesA.size());
+    const auto segmentSizeB = getPairSegmentSize(entitiesB.size());
+    std::vector<PairTile> tiles;
+    for(size_t a = 0; a < entitiesA.size(); a += segmentSizeA) {
+        for(size_t b = 0; b < entitiesB.size(); b += segmentSizeB) {
+            tiles.push_back(PairTile{a, std::min(a + segmentSizeA, entitiesA.size()),
+                b, std::min(b + segmentSizeB, entitiesB.size()), false});
+        }
+    }
+
+    auto output = forEachPairInTiles<Output>(entitiesA, entitiesB, tiles, func, executionPolicy);
+    handle.complete();
+    return output;
+}
+
+template <typename... Components>
+void World::serialize(const std::vector<EntityId>& entities, std::vector<uint8_t>& data) {
+    static_assert((... && std::is_trivially_copyable<Components>::value), "Serialized components must be trivially copyable");
+    static_assert(sizeof...(Components) <= 32, "Too many components to serialize at once");
+    // Component ids depend on the order the types were first used in, which might differ in the other process, so
+    // every entity is prefixed with a bitmask of the listed components it has instead of its component mask.
+    auto append = [&data](const void* src, size_t size) {
+        const auto offset = data.size();
+        data.resize(offset + size);
+        std::memcpy(data.data() + offset, src, size);
+    };
+    const auto count = static_cast<uint32_t>(entities.size());
+    append(&count, sizeof(count));
+    for(const auto entityId : entities) {
+        uint32_t present = 0, bit = 0;
+        (..., (present |= static_cast<uint32_t>(hasComponents<Components>(entityId)) << bit++));
+        append(&present, sizeof(present));
+        (..., (hasComponents<Components>(entityId) ? append(&getComponent<const Components>(entityId), sizeof(Components)) : void()));
+    }
+}
+
+template <typename... Components>
+std::optional<std::vector<EntityId>> World::deserialize(const uint8_t* data, size_t size) {
+    static_assert((... && std::is_trivially_copyable<Components>::value), "Serialized components must be trivially copyable");
+    // The data might come from a file, so check everything before creating the first entity
+    static constexpr uint32_t knownComponents = (uint32_t(1) << sizeof...(Components)) - 1;
+    uint32_t count = 0;
+    if(size < sizeof(count)) return std::nullopt;
+    std::memcpy(&count, data, sizeof(count));
+    // every entity has at least its bitmask
+    if(count > (size - sizeof(count)) / sizeof(uint32_t)) return std::nullopt;
+    size_t offset = sizeof(count);
+    for(uint32_t i = 0; i < count; ++i) {
+        uint32_t present = 0, bit = 0;
+        if(size - offset < sizeof(present)) return std::nullopt;
+        std::memcpy(&present, data + offset, sizeof(present));
+        offset += sizeof(present);
+        if(present & ~knownComponents) return std::nullopt;
+        size_t entitySize = 0;
+        (..., (entitySize += (present >> bit++) & 1 ? sizeof(Components) : 0));
+        if(size - offset < entitySize) return std::nullopt;
+        offset += entitySize;
+    }
+    if(offset != size) return std::nullopt;
+
+    offset = sizeof(count);
+    auto readComponent = [this, data, &offset]<typename ComponentType>(EntityId entityId, ComponentType*) {
+        alignas(ComponentType) unsigned char storage[sizeof(ComponentType)];
+        std::memcpy(storage, data + offset, sizeof(ComponentType));
+        offset += sizeof(ComponentType);
+        addComponent<ComponentType>(entityId, *std::launder(reinterpret_cast<ComponentType*>(storage)));
+    };
+    std::vector<EntityId> entities;
+    entities.reserve(count);
+    for(uint32_t i = 0; i < count; ++i) {
+        uint32_t present = 0, bit = 0;
+        std::memcpy(&present, data + offset, sizeof(present));
+        offset += sizeof(present);
+        const auto entityId = createEntity().getId();
+        (..., ((present >> bit++) & 1 ? readComponent(entityId, static_cast<Components*>(nullptr)) : void()));
+        flush(entityId);
+        entities.push_back(entityId);
     }
+    return entities;
 }
 
 template <typename ComponentType, typename... Args>
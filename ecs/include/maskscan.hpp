@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace ecs {
+
+// Sets bit i % 64 of out[i / 64] if (masks[i] & mask) == mask and bit i % 64 of valid[i / 64] is set,
+// for i in [0, count). out needs (count + 63) / 64 words, the bits after count in the last word are zero.
+// Uses AVX-512 or AVX2 if the CPU supports it (checked at runtime), otherwise scalar code.
+void scanMasks(const uint64_t* masks, const uint64_t* valid, size_t count, uint64_t mask, uint64_t* out);
+
+} // namespace ecs
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+namespace ecs::numa {
+
+// Number of NUMA nodes that have memory and CPUs. Returns 1 if the system is not NUMA or it can not be determined.
+size_t getNodeCount();
+
+// CPUs belonging to the given node
+const std::vector<int>& getNodeCpus(size_t node);
+
+// The node of the CPU the calling thread is running on right now (0 if it can not be determined)
+size_t getCurrentNode();
+
+// Number of memory regions that could not be bound to their node (e.g. because the kernel doesn't support mbind or
+// a cgroup doesn't allow the node). Their memory is placed wherever the OS likes.
+size_t getBindFailures();
+
+// Blocks allocated with a node >= 0 are placed on that node, otherwise this is a plain operator new. Small blocks
+// share pages with other blocks of the same node and are kept for reuse by the next allocation of the same size on
+// that node when they are freed. Their memory is still given back to the OS: the pages only a freed block covers right
+// away and the 2 MiB regions they are carved out of once all of their blocks are freed.
+// A block has to be freed with the same size and node it was allocated with.
+void* allocate(size_t size, int node);
+void free(void* ptr, size_t size, int node);
+
+} // namespace ecs::numa
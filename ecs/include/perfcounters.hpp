@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+#include "allocations.hpp"
+
+namespace ecs {
+
+struct PerfCounterValues {
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+    uint64_t llcMisses = 0; // last level cache
+    uint64_t branchMisses = 0;
+};
+
+// Hardware performance counters of a single thread (Linux perf_event_open). They only count in user space, so they
+// work with the default perf_event_paranoid setting.
+class PerfCounters {
+public:
+    // Opened for the calling thread the first time. nullptr if they are not available (not Linux, no permission, VMs
+    // without a PMU). Counters the CPU doesn't support individually stay at zero.
+    static PerfCounters* forThisThread();
+
+    ~PerfCounters();
+    PerfCounters(const PerfCounters& other) = delete;
+    PerfCounters& operator=(const PerfCounters& other) = delete;
+
+    // Values since the counters were opened
+    PerfCounterValues read() const;
+
+private:
+    static const size_t COUNTER_COUNT = 4;
+
+    PerfCounters() = default;
+    bool open();
+
+    int mGroup = -1;
+    // index into the values read from the group per counter, -1 if it couldn't be opened
+    int mIndices[COUNTER_COUNT] = {-1, -1, -1, -1};
+    int mFds[COUNTER_COUNT] = {-1, -1, -1, -1};
+    size_t mOpenCount = 0;
+};
+
+// Aggregates the time and hardware counters of systems (see World::setProfiler). Parallel systems are measured on
+// every thread that runs a part of them and the values of all threads are added up.
+// With ECS_TRACK_ALLOCATIONS the allocations made by systems (including starting them) are counted too, in total
+// and per frame (see finishFrame).
+class SystemProfiler {
+public:
+    struct Profile {
+        std::string name;
+        uint64_t invocations = 0;
+        double seconds = 0.0; // summed over all threads
+        PerfCounterValues counters;
+        uint64_t allocations = 0, allocatedBytes = 0;
+        uint64_t lastFrameAllocations = 0, lastFrameAllocatedBytes = 0;
+        uint64_t maxFrameAllocations = 0;
+        uint64_t allocatingFrames = 0; // frames in which the system allocated at all
+
+        double instructionsPerCycle() const { return counters.cycles ? double(counters.instructions) / counters.cycles : 0.0; }
+    };
+
+    // Added to concurrently by the threads running a system
+    struct Counters {
+        std::string name;
+        std::atomic<uint64_t> invocations = 0;
+        std::atomic<uint64_t> nanoseconds = 0;
+        std::atomic<uint64_t> cycles = 0, instructions = 0, llcMisses = 0, branchMisses = 0;
+        AllocationCounters allocations;
+        // at the end of the last frame, only touched by finishFrame
+        uint64_t frameStartAllocations = 0, frameStartBytes = 0;
+        uint64_t lastFrameAllocations = 0, lastFrameBytes = 0, maxFrameAllocations = 0, allocatingFrames = 0;
+    };
+
+    // Registers the system the first time. The reference stays valid until the profiler is destroyed.
+    Counters& getCounters(const std::string& name);
+
+    // Runs func on the calling thread and adds its time and counters to the system
+    template <typename Func>
+    static void measure(Counters& counters, Func&& func);
+
+    // Sorted by time, the most expensive system first
+    std::vector<Profile> getProfiles() const;
+    void reset();
+
+    // Ends the frame for the per frame allocation counts. Called by World::finishTick.
+    void finishFrame();
+
+    // Whether hardware counters are available (at least on the calling thread)
+    static bool hasPerfCounters() { return PerfCounters::forThisThread() != nullptr; }
+
+private:
+    mutable std::mutex mMutex;
+    std::deque<Counters> mCounters; // deque, so references stay valid
+    std::unordered_map<std::string, Counters*> mNames;
+};
+
+template <typename Func>
+void SystemProfiler::measure(Counters& counters, Func&& func) {
+    AllocationScope allocations(&counters.allocations);
+    auto perf = PerfCounters::forThisThread();
+    const auto before = perf ? perf->read() : PerfCounterValues{};
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    counters.nanoseconds.fetch_add(nanoseconds.count(), std::memory_order_relaxed);
+    if(perf) {
+        const auto after = perf->read();
+        counters.cycles.fetch_add(after.cycles - before.cycles, std::memory_order_relaxed);
+        counters.instructions.fetch_add(after.instructions - before.instructions, std::memory_order_relaxed);
+        counters.llcMisses.fetch_add(after.llcMisses - before.llcMisses, std::memory_order_relaxed);
+        counters.branchMisses.fetch_add(after.branchMisses - before.branchMisses, std::memory_order_relaxed);
+    }
+}
+
+} // namespace ecs
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+
+#include <netinet/in.h>
+
+#include "ecs.hpp"
+
+namespace ecs {
+
+class ByteWriter {
+public:
+    explicit ByteWriter(std::vector<uint8_t>& data) : mData(data) {}
+
+    template <typename T>
+    void write(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be written");
+        const auto offset = mData.size();
+        mData.resize(offset + sizeof(T));
+        std::memcpy(mData.data() + offset, &value, sizeof(T));
+    }
+
+    // Maps value from [min, max] to 16 bits
+    void writeQuantized(float value, float min, float max) {
+        const auto t = std::clamp((value - min) / (max - min), 0.0f, 1.0f);
+        write(static_cast<uint16_t>(std::lround(t * 65535.0f)));
+    }
+
+private:
+    std::vector<uint8_t>& mData;
+};
+
+class ByteReader {
+public:
+    ByteReader(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+    // Reading past the end returns zeros and makes failed() true
+    template <typename T>
+    T read() {
+        static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable types can be read");
+        T value{};
+        if(mOffset + sizeof(T) > mSize) {
+            mFailed = true;
+            return value;
+        }
+        std::memcpy(&value, mData + mOffset, sizeof(T));
+        mOffset += sizeof(T);
+        return value;
+    }
+
+    float readQuantized(float min, float max) {
+        return min + read<uint16_t>() / 65535.0f * (max - min);
+    }
+
+    void skip(size_t size) {
+        mFailed = mFailed || mOffset + size > mSize;
+        mOffset = std::min(mOffset + size, mSize);
+    }
+
+    bool failed() const { return mFailed; }
+    bool atEnd() const { return mOffset >= mSize; }
+
+private:
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mOffset = 0;
+    bool mFailed = false;
+};
+
+// The components that are replicated and how they are encoded. Server and client need to add the same components
+// in the same order, since they are identified by their index in the schema.
+class ReplicationSchema {
+public:
+    static const size_t MAX_COMPONENTS = 32;
+
+    // encode(const ComponentType&, ByteWriter&) writes the (quantized) component, decode(ByteReader&) returns it
+    template <typename ComponentType, typename EncodeFunc, typename DecodeFunc>
+    void add(EncodeFunc encode, DecodeFunc decode);
+
+    // Sends the bytes of the component as they are
+    template <typename ComponentType>
+    void add() {
+        add<ComponentType>([](const ComponentType& component, ByteWriter& writer) { writer.write(component); },
+            [](ByteReader& reader) { return reader.read<ComponentType>(); });
+    }
+
+    size_t getComponentCount() const { return mComponents.size(); }
+
+private:
+    friend class ReplicationServer;
+    friend class ReplicationClient;
+
+    struct Component {
+        ComponentMask mask;
+        std::function<void(World&, EntityId, ByteWriter&)> encode;
+        // adds the component if the entity doesn't have it yet
+        std::function<void(World&, EntityId, ByteReader&)> decode;
+        std::function<void(World&, EntityId)> remove;
+    };
+    std::vector<Component> mComponents;
+};
+
+struct ReplicationPosition {
+    float x = 0.0f, y = 0.0f, z = 0.0f;
+};
+
+// Sends the replicated components of the entities relevant to each client over UDP. Every client has a viewer
+// position and radius (see ReplicationClient::sendViewer) and entities are relevant while their position is within
+// that radius. Every tick the priority of a relevant entity (higher when it's closer) is added to an accumulator per
+// client and the entities with the highest accumulated priority are sent, until the client's budget for the tick is
+// used up. Sending an entity resets its accumulator, so far away entities are sent less often, but never starve.
+// Datagrams might be lost, but an entity is sent again with its current state the next time its turn comes.
+// Removals are sent every tick until the client acknowledges them, so lost ones don't leave entities behind.
+class ReplicationServer {
+public:
+    struct Config {
+        uint16_t port = 27015;
+        size_t bytesPerTick = 8 * 1024; // per client
+        size_t maxDatagramSize = 1200;
+        std::chrono::milliseconds clientTimeout = std::chrono::seconds(5);
+    };
+
+    // Throws std::system_error if the socket can't be opened or bound (e.g. the port is in use)
+    ReplicationServer(World& world, const ReplicationSchema& schema, const Config& config);
+    ~ReplicationServer();
+    ReplicationServer(const ReplicationServer& other) = delete;
+    ReplicationServer& operator=(const ReplicationServer& other) = delete;
+
+    // Entities are only replicated if they have PositionComponent, func(const PositionComponent&) returns their position
+    template <typename PositionComponent, typename Func>
+    void setPosition(Func func);
+
+    // Receives viewer updates from clients and sends the updates for this tick. Call this between ticks.
+    void update();
+
+    size_t getClientCount() const { return mClients.size(); }
+    uint16_t getPort() const { return mConfig.port; }
+
+private:
+    struct Client {
+        sockaddr_in address;
+        ReplicationPosition viewer;
+        float radius;
+        std::chrono::steady_clock::time_point lastHeard;
+        std::vector<float> priority; // accumulated priority, per entity
+        std::vector<uint8_t> relevant; // this tick
+        std::vector<uint8_t> known; // per entity, see Known
+    };
+
+    enum Known : uint8_t {
+        Unknown = 0,
+        Sent, // the client has been sent the entity
+        Removing, // the removal was sent, but not acknowledged yet
+    };
+
+    void receive();
+    void receiveRemovalAck(const sockaddr_in& address, ByteReader& reader);
+    void updatePriority(EntityId entityId, const ReplicationPosition& position);
+    void sendUpdates(Client& client);
+
+    World& mWorld;
+    const ReplicationSchema& mSchema;
+    Config mConfig;
+    int mSocket = -1;
+    uint32_t mTick = 0;
+    std::vector<Client> mClients;
+    std::function<void()> mUpdatePriorities;
+};
+
+// Receives the state sent by a ReplicationServer and applies it to a world. Server entities are mapped to local ones.
+class ReplicationClient {
+public:
+    // Throws std::runtime_error if the host can't be resolved and std::system_error if the socket can't be opened
+    ReplicationClient(World& world, const ReplicationSchema& schema, const std::string& host, uint16_t port);
+    ~ReplicationClient();
+    ReplicationClient(const ReplicationClient& other) = delete;
+    ReplicationClient& operator=(const ReplicationClient& other) = delete;
+
+    // Tells the server which entities are relevant. This is also how the server learns about the client, so it
+    // has to be sent regularly (more often than the server's client timeout).
+    void sendViewer(const ReplicationPosition& position, float radius);
+
+    // Applies all received datagrams to the world and acknowledges the removals in them. Call this between ticks.
+    // Returns the number of applied datagrams.
+    size_t update();
+
+    // INVALID_ENTITY if the server entity has not been received (or was removed)
+    EntityId getLocalEntity(EntityId serverEntity) const;
+
+private:
+    void apply(const uint8_t* data, size_t size);
+
+    struct RemoteEntity {
+        EntityId local; // INVALID_ENTITY if it was removed
+        uint32_t tick; // of the latest applied state or removal, so we can skip reordered datagrams
+    };
+
+    World& mWorld;
+    const ReplicationSchema& mSchema;
+    int mSocket = -1;
+    std::unordered_map<EntityId, RemoteEntity> mEntities;
+    std::vector<EntityId> mRemovalAcks; // received in this update
+};
+
+template <typename ComponentType, typename EncodeFunc, typename DecodeFunc>
+void ReplicationSchema::add(EncodeFunc encode, DecodeFunc decode) {
+    static_assert(std::is_invocable_r<ComponentType, DecodeFunc, ByteReader&>::value, "Decode function has invalid signature");
+    assert(mComponents.size() < MAX_COMPONENTS);
+    mComponents.push_back(Component{componentMask<ComponentType>(),
+        [encode](World& world, EntityId entityId, ByteWriter& writer) {
+            encode(world.getComponent<const ComponentType>(entityId), writer);
+        },
+        [decode](World& world, EntityId entityId, ByteReader& reader) {
+            if(world.hasComponents<ComponentType>(entityId)) {
+                world.getComponent<ComponentType>(entityId) = decode(reader);
+            } else {
+                world.addComponent<ComponentType>(entityId, decode(reader));
+            }
+        },
+        [](World& world, EntityId entityId) {
+            if(world.hasComponents<ComponentType>(entityId)) world.removeComponent<ComponentType>(entityId);
+        }});
+}
+
+template <typename PositionComponent, typename Func>
+void ReplicationServer::setPosition(Func func) {
+    mUpdatePriorities = [this, func]() {
+        // a parallel system over the pool, each entity only touches its own slots in the client arrays
+        mWorld.tickSystem<const PositionComponent>(false, true, [this, &func](EntityHandle e, const PositionComponent& component) {
+            updatePriority(e.getId(), func(component));
+        });
+    };
+}
+
+} // namespace ecs
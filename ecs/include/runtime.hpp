@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "ecs.hpp"
+
+namespace ecs {
+
+// Steps a number of independent worlds (e.g. match instances) concurrently on one shared WorkerPool, instead of
+// every world using its own threads. All worlds created by the runtime use its pool for parallel iteration too.
+class Runtime {
+public:
+    // Executes one frame of a world, i.e. ticks its systems and calls World::finishTick
+    using StepFunc = std::function<void(World&)>;
+
+    struct FrameStats {
+        uint64_t frames = 0;
+        double lastFrameSeconds = 0.0;
+        double maxFrameSeconds = 0.0;
+        double totalSeconds = 0.0;
+
+        double averageFrameSeconds() const { return frames > 0 ? totalSeconds / frames : 0.0; }
+    };
+
+    using WorldId = size_t;
+
+    explicit Runtime(std::shared_ptr<WorkerPool> pool = WorkerPool::getDefault());
+    Runtime(const Runtime& other) = delete;
+    Runtime& operator=(const Runtime& other) = delete;
+
+    WorldId createWorld(StepFunc step);
+    void destroyWorld(WorldId id);
+
+    World& getWorld(WorldId id);
+    const FrameStats& getStats(WorldId id) const;
+
+    // Steps every world exactly once, so no world can starve the others. The worlds with the longest previous
+    // frame are started first, so that a long frame doesn't end up running alone at the end.
+    // The calling thread steps worlds too.
+    // Afterwards the entities queued for migration (World::queueMigration) in all worlds are migrated.
+    void stepAll();
+
+    // The entities migrated by the last call to stepAll, e.g. to update references to them
+    const std::vector<World::Migration>& getMigrations() const { return mMigrations; }
+
+    size_t getWorldCount() const { return mWorlds.size(); }
+    WorkerPool& getWorkerPool() const { return *mWorkerPool; }
+
+private:
+    struct Entry {
+        std::unique_ptr<World> world;
+        StepFunc step;
+        FrameStats stats;
+    };
+
+    std::shared_ptr<WorkerPool> mWorkerPool;
+    // destroyed worlds leave a nullptr, so that ids stay valid
+    std::vector<std::unique_ptr<Entry>> mWorlds;
+    std::vector<World::Migration> mMigrations;
+};
+
+} // namespace ecs
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstring>
+
+#include "ecs.hpp"
+
+namespace ecs {
+
+// Layout of the shared memory region. Everything is written by SharedWorldExport and only read by other processes.
+namespace shm {
+    static const uint32_t MAGIC = 0x31534345; // "ECS1"
+    static const size_t MAX_COMPONENTS = 16;
+    static const size_t MAX_NAME_LENGTH = 48;
+
+    struct ComponentInfo {
+        char name[MAX_NAME_LENGTH];
+        uint64_t mask; // the component's bit in the component masks
+        uint64_t size; // of a single component
+        uint64_t offset; // of the component array (indexed by entity id) from the start of the region
+    };
+
+    struct Header {
+        std::atomic<uint32_t> magic; // set last, once the region is initialized
+        uint32_t componentCount;
+        uint64_t capacity; // maximum number of entities
+        uint64_t size; // of the whole region
+        // seqlock: odd while a snapshot is being written
+        std::atomic<uint64_t> sequence;
+        uint64_t frame; // number of published snapshots
+        uint64_t entityCount;
+        uint64_t masksOffset; // one ComponentMask per entity
+        uint64_t validOffset; // bitmap with one bit per entity (see World::isValid)
+        ComponentInfo components[MAX_COMPONENTS];
+    };
+}
+
+// Publishes the component masks and selected component pools of a world to a POSIX shared memory object, so that
+// other processes (monitoring, replays, ...) can read them with SharedWorldReader without copying through sockets.
+class SharedWorldExport {
+public:
+    // name is passed to shm_open, so it should start with a slash. Entities with ids >= maxEntities are not exported.
+    SharedWorldExport(const std::string& name, size_t maxEntities);
+    ~SharedWorldExport(); // unlinks the shared memory object
+    SharedWorldExport(const SharedWorldExport& other) = delete;
+    SharedWorldExport& operator=(const SharedWorldExport& other) = delete;
+
+    // Components are copied bytewise, so they have to be trivially copyable. Has to be called before the first publish.
+    template <typename ComponentType>
+    void exportComponent(const std::string& name);
+
+    // Writes a new snapshot of the world. Call this between ticks, since it only waits for systems writing to
+    // exported components, not for ones creating or destroying entities.
+    // The first call creates the shared memory object and throws std::system_error if that fails.
+    void publish(World& world);
+
+    uint64_t getFrame() const;
+
+private:
+    struct Component {
+        std::string name;
+        ComponentMask mask;
+        size_t size;
+        std::function<void(World&, uint8_t*, size_t)> copy;
+    };
+
+    void createRegion();
+
+    std::string mName;
+    size_t mCapacity;
+    std::vector<Component> mComponents;
+    uint8_t* mRegion = nullptr;
+    size_t mSize = 0;
+};
+
+class SharedWorldReader {
+public:
+    // A view into the region, which is only valid inside of SharedWorldReader::read
+    class Snapshot {
+    public:
+        uint64_t getFrame() const { return mHeader.frame; }
+        size_t getEntityCount() const { return std::min(mHeader.entityCount, mHeader.capacity); }
+
+        bool isValid(EntityId entityId) const;
+        ComponentMask getComponentMask(EntityId entityId) const;
+
+        // Index of the exported component with the given name, -1 if it was not exported
+        int findComponent(const std::string& name) const;
+        bool hasComponent(EntityId entityId, int component) const;
+
+        template <typename ComponentType>
+        const ComponentType& get(EntityId entityId, int component) const {
+            assert(hasComponent(entityId, component));
+            const auto& info = mHeader.components[component];
+            assert(info.size == sizeof(ComponentType));
+            return *reinterpret_cast<const ComponentType*>(mRegion + info.offset + entityId * info.size);
+        }
+
+    private:
+        friend class SharedWorldReader;
+        Snapshot(const shm::Header& header, const uint8_t* region) : mHeader(header), mRegion(region) {}
+
+        const shm::Header& mHeader;
+        const uint8_t* mRegion;
+    };
+
+    // Maps the shared memory object read-only. If it doesn't exist (yet), isOpen() returns false.
+    explicit SharedWorldReader(const std::string& name);
+    ~SharedWorldReader();
+    SharedWorldReader(const SharedWorldReader& other) = delete;
+    SharedWorldReader& operator=(const SharedWorldReader& other) = delete;
+
+    bool isOpen() const { return mRegion != nullptr; }
+
+    // Calls func with the current snapshot, which is read in place. If a new snapshot was published while func was
+    // running, the data func has seen might have been torn, so it is called again until it saw a consistent snapshot.
+    // Returns the frame of that snapshot.
+    template <typename Func>
+    uint64_t read(Func&& func) {
+        uint64_t frame = 0;
+        while(!tryRead(func, frame)) std::this_thread::yield();
+        return frame;
+    }
+
+    // Only one attempt, returns false if func might have seen a torn snapshot
+    template <typename Func>
+    bool tryRead(Func&& func, uint64_t& frame) {
+        assert(isOpen());
+        const auto& header = getHeader();
+        const auto sequence = header.sequence.load(std::memory_order_acquire);
+        if(sequence & 1) return false;
+        frame = header.frame;
+        func(Snapshot(header, mRegion));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return header.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+private:
+    const shm::Header& getHeader() const { return *reinterpret_cast<const shm::Header*>(mRegion); }
+
+    const uint8_t* mRegion = nullptr;
+    size_t mSize = 0;
+};
+
+template <typename ComponentType>
+void SharedWorldExport::exportComponent(const std::string& name) {
+    static_assert(std::is_trivially_copyable<ComponentType>::value, "Exported components must be trivially copyable");
+    assert(!mRegion && "Components have to be exported before the first publish");
+    assert(mComponents.size() < shm::MAX_COMPONENTS && name.size() < shm::MAX_NAME_LENGTH);
+    mComponents.push_back(Component{name, componentMask<ComponentType>(), sizeof(ComponentType),
+        [](World& world, uint8_t* dst, size_t capacity) {
+            // as a system, so we wait for the systems writing to it
+            world.tickSystem<const ComponentType>(false, true, [dst, capacity](EntityHandle e, const ComponentType& component) {
+                if(e.getId() < capacity) std::memcpy(dst + e.getId() * sizeof(ComponentType), &component, sizeof(ComponentType));
+            });
+        }});
+}
+
+} // namespace ecs
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+#include "ecs.hpp"
+
+namespace ecs {
+
+// Streams regions of a map in and out of a world. A region is a file written by save, containing a batch of
+// serialized entities (see World::serialize). Loading reads the file on a background I/O thread and deserializes it
+// into a staging world on the worker pool, so the world is not touched until sync moves the staged entities into
+// it in bulk (see World::migrate). Unloading destroys all entities of a region in one batch.
+class LevelStreamer {
+public:
+    using RegionId = uint64_t;
+
+    // world is the world regions are spliced into
+    explicit LevelStreamer(World& world);
+    ~LevelStreamer(); // waits for pending loads
+    LevelStreamer(const LevelStreamer& other) = delete;
+    LevelStreamer& operator=(const LevelStreamer& other) = delete;
+
+    // The components stored in region files. They have to be trivially copyable.
+    template <typename... Components>
+    void setComponents();
+
+    // Writes the entities to a region file. Returns false if the file could not be written.
+    bool save(const std::string& path, const std::vector<EntityId>& entities);
+
+    // Starts loading a region. The returned handle is complete when the region is staged, it is added to the world
+    // by the next call to sync after that. If the file can't be read or is not a valid region file (e.g. truncated),
+    // the handle is completed as well and hasFailed returns true until the region is unloaded or loaded again.
+    SystemHandle load(RegionId region, const std::string& path);
+
+    // Moves all staged regions into the world and returns their ids. Call this between ticks.
+    std::vector<RegionId> sync();
+
+    // Destroys all entities of a loaded region. If it is still loading, it is discarded once it is staged, but the
+    // region can be loaded again right away. Call this between ticks.
+    void unload(RegionId region);
+
+    bool isLoaded(RegionId region) const;
+    bool hasFailed(RegionId region) const;
+    // The entities of a loaded region in the world
+    const std::vector<EntityId>& getEntities(RegionId region) const;
+
+private:
+    enum class State { Loading, Staged, Loaded, Failed };
+
+    struct Region {
+        State state;
+        std::unique_ptr<World> staging;
+        std::vector<EntityId> entities; // in staging while staged, in the world when loaded
+        SystemHandle handle;
+        uint64_t load; // so the result of a discarded load doesn't end up in a region that is loaded again
+    };
+
+    struct Read {
+        RegionId region;
+        uint64_t load;
+        SystemHandle handle;
+        std::string path;
+    };
+
+    void ioMain();
+    // data is empty if the file couldn't be read
+    void stage(const Read& read, std::vector<uint8_t> data);
+
+    World& mWorld;
+    std::function<void(World&, const std::vector<EntityId>&, std::vector<uint8_t>&)> mSerialize;
+    std::function<std::optional<std::vector<EntityId>>(World&, const uint8_t*, size_t)> mDeserialize;
+
+    std::unordered_map<RegionId, Region> mRegions; // protected by mMutex
+    std::vector<SystemHandle> mDiscardedLoads; // protected by mMutex, still running, so we wait for them
+    uint64_t mLoadCount = 0; // protected by mMutex
+    mutable std::mutex mMutex;
+
+    std::deque<Read> mReads; // protected by mReadMutex
+    std::mutex mReadMutex;
+    std::condition_variable mReadCondition;
+    bool mQuit = false;
+    std::thread mIoThread;
+};
+
+template <typename... Components>
+void LevelStreamer::setComponents() {
+    mSerialize = [](World& world, const std::vector<EntityId>& entities, std::vector<uint8_t>& data) {
+        world.serialize<Components...>(entities, data);
+    };
+    mDeserialize = [](World& world, const uint8_t* data, size_t size) {
+        return world.deserialize<Components...>(data, size);
+    };
+}
+
+} // namespace ecs
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <string>
+#include <optional>
+
+namespace ecs {
+
+// Applied to all threads owned by the ECS, i.e. the workers of a WorkerPool, which also run the asynchronous systems
+// of the worlds using that pool.
+struct ThreadConfig {
+    // 0 means std::thread::hardware_concurrency()
+    size_t workerCount = 0;
+    bool numaAware = false;
+    // CPUs worker i may run on are workerAffinity[i % workerAffinity.size()]. If empty, workers are not pinned,
+    // unless the pool is NUMA aware, in which case they are pinned to the CPUs of their node.
+    std::vector<std::vector<int>> workerAffinity;
+    // Linux truncates thread names to 15 characters. Workers get their index appended.
+    std::string workerName = "ecs-worker";
+    // nice value of all ECS threads. If not set, it is inherited from the creating thread.
+    std::optional<int> niceness;
+};
+
+// A simple pool of worker threads that execute jobs in FIFO order.
+// Multiple worlds may share the same pool, by default they all use the pool returned by getDefault().
+//
+// If the pool is NUMA aware, the workers are distributed over the NUMA nodes round robin and pinned to the CPUs
+// of their node. Entities are then owned by nodes in chunks of CHUNK_SIZE (also round robin), component blocks are
+// allocated on the node owning their first entity and parallelFor hands chunks to workers of the owning node first.
+class WorkerPool {
+public:
+    static const size_t CHUNK_SIZE = 1024;
+
+    explicit WorkerPool(const ThreadConfig& config = ThreadConfig());
+    WorkerPool(size_t workerCount, bool numaAware = false);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool& other) = delete;
+    WorkerPool& operator=(const WorkerPool& other) = delete;
+
+    // Jobs may have an owner (e.g. the world that submitted them), see runPendingJob
+    void submit(std::function<void()> job, const void* owner = nullptr);
+
+    // Calls func(begin, end) for chunks of [0, count) in parallel and returns when all are done.
+    // The calling thread processes chunks as well. The helper jobs have the given owner.
+    void parallelFor(size_t count, const std::function<void(size_t, size_t)>& func) {
+        parallelFor(count, CHUNK_SIZE, func);
+    }
+    void parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& func,
+                     const void* owner = nullptr);
+
+    // Runs one queued job without an owner or of the given owner on the calling thread, if there is one. Threads that
+    // block inside a job (e.g. a world stepped on the pool, waiting for its systems) use this to help, so the pool
+    // can't deadlock. Jobs of other owners are left alone, so that e.g. waiting in one world stepped by a Runtime
+    // doesn't end up running the whole step of another world in between.
+    bool runPendingJob(const void* owner = nullptr);
+
+    // whether the calling thread is a worker of any pool
+    static bool isWorkerThread();
+
+    const ThreadConfig& getConfig() const { return mConfig; }
+    size_t getWorkerCount() const { return mWorkers.size(); }
+    // Workers that should have been pinned to CPUs (see ThreadConfig::workerAffinity), but couldn't be, e.g. because
+    // the CPUs don't exist or are not in the process's cpuset. They run on any CPU.
+    size_t getUnpinnedWorkerCount() const { return mUnpinnedWorkers; }
+    size_t getNodeCount() const { return mNodeCount; }
+
+    // -1 if the pool is not NUMA aware, so that the memory is allocated normally
+    int getNodeForIndex(size_t index) const {
+        return mNodeCount > 1 ? static_cast<int>((index / CHUNK_SIZE) % mNodeCount) : -1;
+    }
+
+    static size_t defaultWorkerCount();
+    static std::shared_ptr<WorkerPool> getDefault();
+
+private:
+    struct Job {
+        std::function<void()> func;
+        const void* owner;
+    };
+
+    void workerMain(size_t node);
+    // anyOwner is set for workers, which run every job
+    bool popJob(size_t node, std::function<void()>& job, bool anyOwner, const void* owner = nullptr);
+
+    ThreadConfig mConfig;
+    size_t mNodeCount;
+    size_t mUnpinnedWorkers = 0;
+    std::vector<std::thread> mWorkers;
+    // one queue per node and the last one for jobs that may run anywhere
+    std::vector<std::deque<Job>> mJobs;
+    std::mutex mMutex;
+    std::condition_variable mJobAvailable;
+    bool mStop;
+};
+
+} // namespace ecs
@@ -0,0 +1,69 @@
+#include "maskscan.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ECS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace ecs {
+
+namespace {
+    uint64_t scanWordScalar(const uint64_t* masks, size_t count, uint64_t mask) {
+        uint64_t bits = 0;
+        for(size_t i = 0; i < count; ++i) {
+            bits |= static_cast<uint64_t>((masks[i] & mask) == mask) << i;
+        }
+        return bits;
+    }
+
+    // scans count masks (at most 64) into one word of bits
+    using ScanWordFunc = uint64_t (*)(const uint64_t* masks, size_t count, uint64_t mask);
+
+#ifdef ECS_X86_SIMD
+    __attribute__((target("avx2")))
+    uint64_t scanWordAvx2(const uint64_t* masks, size_t count, uint64_t mask) {
+        const auto m = _mm256_set1_epi64x(mask);
+        uint64_t bits = 0;
+        size_t i = 0;
+        for(; i + 4 <= count; i += 4) {
+            const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(masks + i));
+            const auto eq = _mm256_cmpeq_epi64(_mm256_and_si256(v, m), m);
+            bits |= static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(eq))) << i;
+        }
+        return i < count ? bits | (scanWordScalar(masks + i, count - i, mask) << i) : bits;
+    }
+
+    __attribute__((target("avx512f")))
+    uint64_t scanWordAvx512(const uint64_t* masks, size_t count, uint64_t mask) {
+        const auto m = _mm512_set1_epi64(mask);
+        uint64_t bits = 0;
+        size_t i = 0;
+        for(; i + 8 <= count; i += 8) {
+            const auto v = _mm512_loadu_si512(masks + i);
+            bits |= static_cast<uint64_t>(_mm512_cmpeq_epi64_mask(_mm512_and_si512(v, m), m)) << i;
+        }
+        return i < count ? bits | (scanWordScalar(masks + i, count - i, mask) << i) : bits;
+    }
+#endif
+
+    ScanWordFunc selectScanWord() {
+#ifdef ECS_X86_SIMD
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f")) return scanWordAvx512;
+        if(__builtin_cpu_supports("avx2")) return scanWordAvx2;
+#endif
+        return scanWordScalar;
+    }
+
+    const ScanWordFunc scanWord = selectScanWord();
+}
+
+void scanMasks(const uint64_t* masks, const uint64_t* valid, size_t count, uint64_t mask, uint64_t* out) {
+    for(size_t word = 0; word * 64 < count; ++word) {
+        const auto n = count - word * 64 < 64 ? count - word * 64 : 64;
+        // skip scanning words without valid entities (e.g. all freshly created)
+        out[word] = valid[word] ? scanWord(masks + word * 64, n, mask) & valid[word] : 0;
+    }
+}
+
+} // namespace ecs
@@ -0,0 +1,220 @@
+#include "numa.hpp"
+
+#include <cassert>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <map>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ecs::numa {
+
+namespace {
+    // parses lists like "0-3,8-11"
+    std::vector<int> parseCpuList(const std::string& list) {
+        std::vector<int> cpus;
+        std::stringstream ss(list);
+        std::string range;
+        while(std::getline(ss, range, ',')) {
+            if(range.empty() || range == "\n") continue;
+            const auto dash = range.find('-');
+            const auto first = std::stoi(range.substr(0, dash));
+            const auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for(int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    struct Node {
+        int id; // the OS node id, which might not be the index
+        std::vector<int> cpus;
+    };
+
+    std::vector<Node> detectNodes() {
+        std::vector<Node> nodes;
+#ifdef __linux__
+        // node ids might have holes, so just try a reasonable range and skip nodes without CPUs (e.g. memory only)
+        for(int node = 0; node < 1024; ++node) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            if(!file) continue;
+            std::string list;
+            std::getline(file, list);
+            auto cpus = parseCpuList(list);
+            if(!cpus.empty()) nodes.push_back(Node{node, std::move(cpus)});
+        }
+#endif
+        if(nodes.empty()) nodes.push_back(Node{0, {}});
+        return nodes;
+    }
+
+    const std::vector<Node>& getNodes() {
+        static const auto nodes = detectNodes();
+        return nodes;
+    }
+
+    std::atomic<size_t> bindFailures = 0;
+
+#ifdef __linux__
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    const int MPOL_PREFERRED = 1; // from numaif.h, so we don't need libnuma
+
+    // Blocks smaller than a region are carved out of regions that are bound to the node once, so that small blocks
+    // are placed on the node too and not every block needs its own mapping. Larger blocks are mapped on their own.
+    const size_t REGION_SIZE = 2 * 1024 * 1024;
+    const size_t MAX_ARENA_BLOCK_SIZE = REGION_SIZE / 8; // so at most 1/8 of a region is wasted at its end
+    const size_t ARENA_ALIGNMENT = 64;
+
+    struct Arena {
+        std::mutex mutex;
+        char* currentRegion = nullptr; // the one new blocks are carved out of
+        char* current = nullptr;
+        size_t remaining = 0;
+        std::map<char*, size_t> regions; // start -> number of blocks in use
+        // freed blocks are kept for the next allocation of the same size on this node
+        std::unordered_map<size_t, std::vector<void*>> freeBlocks;
+    };
+
+    std::map<char*, size_t>::iterator findRegion(Arena& arena, void* ptr) {
+        auto it = arena.regions.upper_bound(static_cast<char*>(ptr));
+        assert(it != arena.regions.begin());
+        return std::prev(it);
+    }
+
+    // Returns a region without blocks in use to the OS
+    void releaseRegion(Arena& arena, std::map<char*, size_t>::iterator region) {
+        const auto begin = region->first, end = region->first + REGION_SIZE;
+        for(auto& [size, blocks] : arena.freeBlocks) {
+            blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [begin, end](void* ptr) {
+                return ptr >= begin && ptr < end;
+            }), blocks.end());
+        }
+        munmap(begin, REGION_SIZE);
+        arena.regions.erase(region);
+    }
+
+    Arena& getArena(size_t node) {
+        static std::vector<Arena> arenas(getNodeCount());
+        return arenas[node];
+    }
+
+    void* mapOnNode(size_t size, size_t node) {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED) throw std::bad_alloc();
+        // pages are only placed on first touch, so binding before anything touches them is enough
+        const auto id = static_cast<size_t>(getNodes()[node].id);
+        std::vector<unsigned long> nodeMask(id / 64 + 1);
+        nodeMask[id / 64] = 1ul << (id % 64);
+        // maxnode is one more than the highest node that may be set, the kernel ignores the last bit otherwise
+        if(syscall(SYS_mbind, ptr, size, MPOL_PREFERRED, nodeMask.data(), nodeMask.size() * 64 + 1, 0) != 0) {
+            bindFailures++;
+        }
+        return ptr;
+    }
+
+    size_t roundUp(size_t size, size_t alignment) {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+#endif
+}
+
+size_t getNodeCount() {
+    return getNodes().size();
+}
+
+const std::vector<int>& getNodeCpus(size_t node) {
+    return getNodes()[node % getNodeCount()].cpus;
+}
+
+size_t getCurrentNode() {
+#ifdef __linux__
+    if(getNodeCount() == 1) return 0;
+    const auto cpu = sched_getcpu();
+    for(size_t node = 0; node < getNodeCount(); ++node) {
+        const auto& cpus = getNodeCpus(node);
+        if(std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) return node;
+    }
+#endif
+    return 0;
+}
+
+size_t getBindFailures() {
+    return bindFailures.load();
+}
+
+void* allocate(size_t size, int node) {
+#ifdef __linux__
+    if(node >= 0) {
+        const auto index = static_cast<size_t>(node) % getNodeCount();
+        if(size > MAX_ARENA_BLOCK_SIZE) return mapOnNode(roundUp(size, pageSize), index);
+
+        size = roundUp(std::max<size_t>(size, 1), ARENA_ALIGNMENT);
+        auto& arena = getArena(index);
+        std::lock_guard lock(arena.mutex);
+        auto& freeBlocks = arena.freeBlocks[size];
+        if(!freeBlocks.empty()) {
+            auto ptr = freeBlocks.back();
+            freeBlocks.pop_back();
+            findRegion(arena, ptr)->second++;
+            return ptr;
+        }
+        if(arena.remaining < size) {
+            const auto previous = arena.currentRegion ? arena.regions.find(arena.currentRegion) : arena.regions.end();
+            arena.currentRegion = arena.current = static_cast<char*>(mapOnNode(REGION_SIZE, index));
+            arena.remaining = REGION_SIZE;
+            arena.regions.emplace(arena.currentRegion, 0);
+            // free only releases regions we are not carving blocks out of anymore
+            if(previous != arena.regions.end() && previous->second == 0) releaseRegion(arena, previous);
+        }
+        auto ptr = arena.current;
+        arena.current += size;
+        arena.remaining -= size;
+        arena.regions[arena.currentRegion]++;
+        return ptr;
+    }
+#endif
+    return operator new(size);
+}
+
+void free(void* ptr, size_t size, int node) {
+    if(!ptr) return;
+#ifdef __linux__
+    if(node >= 0) {
+        const auto index = static_cast<size_t>(node) % getNodeCount();
+        if(size > MAX_ARENA_BLOCK_SIZE) {
+            munmap(ptr, roundUp(size, pageSize));
+            return;
+        }
+        size = roundUp(std::max<size_t>(size, 1), ARENA_ALIGNMENT);
+        auto& arena = getArena(index);
+        std::lock_guard lock(arena.mutex);
+        const auto region = findRegion(arena, ptr);
+        assert(region->second > 0);
+        if(--region->second == 0 && region->first != arena.currentRegion) {
+            releaseRegion(arena, region);
+            return;
+        }
+        arena.freeBlocks[size].push_back(ptr);
+        // The region stays mapped for its other blocks, but the pages only this block covers can be given back
+        // already. They keep the node binding and are faulted in again (zeroed) when the block is reused.
+        const auto pagesBegin = roundUp(reinterpret_cast<uintptr_t>(ptr), pageSize);
+        const auto pagesEnd = (reinterpret_cast<uintptr_t>(ptr) + size) / pageSize * pageSize;
+        if(pagesEnd > pagesBegin) madvise(reinterpret_cast<void*>(pagesBegin), pagesEnd - pagesBegin, MADV_DONTNEED);
+        return;
+    }
+#endif
+    operator delete(ptr);
+}
+
+} // namespace ecs::numa
@@ -0,0 +1,142 @@
+#include "perfcounters.hpp"
+
+#include <memory>
+#include <algorithm>
+#include <utility>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+namespace ecs {
+
+PerfCounters* PerfCounters::forThisThread() {
+    thread_local std::unique_ptr<PerfCounters> counters;
+    thread_local bool opened = false;
+    if(!opened) {
+        opened = true;
+        counters.reset(new PerfCounters());
+        if(!counters->open()) counters.reset();
+    }
+    return counters.get();
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+    for(const auto fd : mFds) {
+        if(fd >= 0) close(fd);
+    }
+#endif
+}
+
+bool PerfCounters::open() {
+#if defined(__linux__)
+    // same order as PerfCounterValues
+    const std::pair<uint32_t, uint64_t> events[COUNTER_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+    // one group, so all counters are scheduled together and can be read with a single syscall
+    for(size_t i = 0; i < COUNTER_COUNT; ++i) {
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = events[i].first;
+        attr.config = events[i].second;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        // pid 0 and cpu -1: the calling thread on any CPU
+        const auto fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, mGroup, 0));
+        if(fd < 0) continue;
+        if(mGroup < 0) mGroup = fd;
+        mFds[i] = fd;
+        mIndices[i] = mOpenCount++;
+    }
+    return mGroup >= 0;
+#else
+    return false;
+#endif
+}
+
+PerfCounterValues PerfCounters::read() const {
+    PerfCounterValues values;
+#if defined(__linux__)
+    uint64_t data[1 + COUNTER_COUNT] = {}; // count, values
+    if(::read(mGroup, data, sizeof(data)) < 0) return values;
+    auto value = [&data](int index) { return index >= 0 ? data[1 + index] : 0; };
+    values.cycles = value(mIndices[0]);
+    values.instructions = value(mIndices[1]);
+    values.llcMisses = value(mIndices[2]);
+    values.branchMisses = value(mIndices[3]);
+#endif
+    return values;
+}
+
+
+SystemProfiler::Counters& SystemProfiler::getCounters(const std::string& name) {
+    std::lock_guard lock(mMutex);
+    auto& counters = mNames[name];
+    if(!counters) {
+        counters = &mCounters.emplace_back();
+        counters->name = name;
+    }
+    return *counters;
+}
+
+std::vector<SystemProfiler::Profile> SystemProfiler::getProfiles() const {
+    std::vector<Profile> profiles;
+    {
+        std::lock_guard lock(mMutex);
+        for(const auto& counters : mCounters) {
+            Profile profile;
+            profile.name = counters.name;
+            profile.invocations = counters.invocations.load();
+            profile.seconds = counters.nanoseconds.load() * 1e-9;
+            profile.counters.cycles = counters.cycles.load();
+            profile.counters.instructions = counters.instructions.load();
+            profile.counters.llcMisses = counters.llcMisses.load();
+            profile.counters.branchMisses = counters.branchMisses.load();
+            profile.allocations = counters.allocations.count.load();
+            profile.allocatedBytes = counters.allocations.bytes.load();
+            profile.lastFrameAllocations = counters.lastFrameAllocations;
+            profile.lastFrameAllocatedBytes = counters.lastFrameBytes;
+            profile.maxFrameAllocations = counters.maxFrameAllocations;
+            profile.allocatingFrames = counters.allocatingFrames;
+            profiles.push_back(std::move(profile));
+        }
+    }
+    std::sort(profiles.begin(), profiles.end(), [](const Profile& a, const Profile& b) { return a.seconds > b.seconds; });
+    return profiles;
+}
+
+void SystemProfiler::reset() {
+    std::lock_guard lock(mMutex);
+    for(auto& counters : mCounters) {
+        counters.invocations = 0;
+        counters.nanoseconds = 0;
+        counters.cycles = counters.instructions = counters.llcMisses = counters.branchMisses = 0;
+        counters.allocations.count = counters.allocations.bytes = 0;
+        counters.frameStartAllocations = counters.frameStartBytes = 0;
+        counters.lastFrameAllocations = counters.lastFrameBytes = counters.maxFrameAllocations = 0;
+        counters.allocatingFrames = 0;
+    }
+}
+
+void SystemProfiler::finishFrame() {
+    std::lock_guard lock(mMutex);
+    for(auto& counters : mCounters) {
+        const auto allocations = counters.allocations.count.load(), bytes = counters.allocations.bytes.load();
+        counters.lastFrameAllocations = allocations - counters.frameStartAllocations;
+        counters.lastFrameBytes = bytes - counters.frameStartBytes;
+        counters.frameStartAllocations = allocations;
+        counters.frameStartBytes = bytes;
+        counters.maxFrameAllocations = std::max(counters.maxFrameAllocations, counters.lastFrameAllocations);
+        if(counters.lastFrameAllocations > 0) counters.allocatingFrames++;
+    }
+}
+
+} // namespace ecs
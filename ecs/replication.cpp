@@ -0,0 +1,333 @@
+#include "replication.hpp"
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+namespace ecs {
+
+namespace {
+    const uint32_t STATE_MAGIC = 0x52534345; // "ECSR"
+    const uint32_t VIEWER_MAGIC = 0x56534345; // "ECSV"
+    const uint32_t REMOVAL_ACK_MAGIC = 0x41534345; // "ECSA"
+
+    // Datagram from the server: magic, tick, entry count (uint16) and then the entries.
+    // Entry: server entity id, mask of the schema components it has (0 = remove it), the size of the encoded
+    // components (uint16), so entries can be skipped, and the encoded components.
+    const size_t STATE_HEADER_SIZE = sizeof(uint32_t) * 2 + sizeof(uint16_t);
+    const size_t MAX_DATAGRAM_SIZE = 65507;
+    // Datagram from the client: magic, entry count (uint16) and the server entity ids of the removals it received
+    const size_t MAX_REMOVAL_ACKS = 256;
+
+    struct ViewerMessage {
+        uint32_t magic;
+        ReplicationPosition position;
+        float radius;
+    };
+
+    int openSocket() {
+        const auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(fd < 0) throw std::system_error(errno, std::generic_category(), "socket");
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        return fd;
+    }
+
+    // the destructor doesn't run if the constructor throws, so the socket has to be closed here
+    [[noreturn]] void closeAndThrow(int fd, const std::string& what) {
+        const auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    bool sameAddress(const sockaddr_in& a, const sockaddr_in& b) {
+        return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+    }
+}
+
+ReplicationServer::ReplicationServer(World& world, const ReplicationSchema& schema, const Config& config) :
+        mWorld(world), mSchema(schema), mConfig(config), mSocket(openSocket()) {
+    assert(mConfig.maxDatagramSize > STATE_HEADER_SIZE && mConfig.maxDatagramSize <= MAX_DATAGRAM_SIZE);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(mConfig.port);
+    if(bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        closeAndThrow(mSocket, "bind to port " + std::to_string(mConfig.port));
+    }
+    if(mConfig.port == 0) { // let the OS pick one
+        socklen_t length = sizeof(address);
+        if(getsockname(mSocket, reinterpret_cast<sockaddr*>(&address), &length) != 0) closeAndThrow(mSocket, "getsockname");
+        mConfig.port = ntohs(address.sin_port);
+    }
+}
+
+ReplicationServer::~ReplicationServer() {
+    close(mSocket);
+}
+
+void ReplicationServer::receive() {
+    std::vector<uint8_t> buffer(sizeof(uint32_t) + sizeof(uint16_t) + MAX_REMOVAL_ACKS * sizeof(EntityId));
+    sockaddr_in address;
+    while(true) {
+        socklen_t length = sizeof(address);
+        const auto size = recvfrom(mSocket, buffer.data(), buffer.size(), 0, reinterpret_cast<sockaddr*>(&address), &length);
+        if(size < 0) break;
+        ByteReader reader(buffer.data(), size);
+        const auto magic = reader.read<uint32_t>();
+        if(magic == REMOVAL_ACK_MAGIC) {
+            receiveRemovalAck(address, reader);
+            continue;
+        }
+        ViewerMessage message;
+        if(static_cast<size_t>(size) != sizeof(message) || magic != VIEWER_MAGIC) continue;
+        std::memcpy(&message, buffer.data(), sizeof(message));
+        auto client = std::find_if(mClients.begin(), mClients.end(),
+            [&address](const Client& client) { return sameAddress(client.address, address); });
+        if(client == mClients.end()) {
+            mClients.emplace_back();
+            client = mClients.end() - 1;
+            client->address = address;
+        }
+        client->viewer = message.position;
+        client->radius = message.radius;
+        client->lastHeard = std::chrono::steady_clock::now();
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    mClients.erase(std::remove_if(mClients.begin(), mClients.end(), [this, now](const Client& client) {
+        return now - client.lastHeard > mConfig.clientTimeout;
+    }), mClients.end());
+}
+
+void ReplicationServer::receiveRemovalAck(const sockaddr_in& address, ByteReader& reader) {
+    auto client = std::find_if(mClients.begin(), mClients.end(),
+        [&address](const Client& client) { return sameAddress(client.address, address); });
+    if(client == mClients.end()) return;
+    const auto count = reader.read<uint16_t>();
+    for(uint16_t i = 0; i < count; ++i) {
+        const auto entityId = reader.read<EntityId>();
+        if(reader.failed()) return;
+        // if the entity was sent again since, the acknowledgement is outdated
+        if(entityId < client->known.size() && client->known[entityId] == Removing) client->known[entityId] = Unknown;
+    }
+}
+
+void ReplicationServer::updatePriority(EntityId entityId, const ReplicationPosition& position) {
+    for(auto& client : mClients) {
+        const auto dx = position.x - client.viewer.x, dy = position.y - client.viewer.y, dz = position.z - client.viewer.z;
+        const auto distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+        if(distance > client.radius) continue;
+        client.relevant[entityId] = 1;
+        // close entities are sent every tick if the budget allows it, the ones at the border about a tenth as often
+        client.priority[entityId] += 1.0f + 9.0f * (1.0f - distance / client.radius);
+    }
+}
+
+void ReplicationServer::update() {
+    assert(mUpdatePriorities && "No position component set");
+    receive();
+    mTick++;
+    if(mClients.empty()) return;
+
+    const auto entityCount = mWorld.getEntityCount();
+    for(auto& client : mClients) {
+        client.priority.resize(entityCount, 0.0f);
+        client.known.resize(entityCount, Unknown);
+        client.relevant.assign(entityCount, 0);
+    }
+    mUpdatePriorities();
+    for(auto& client : mClients) sendUpdates(client);
+}
+
+void ReplicationServer::sendUpdates(Client& client) {
+    ComponentMask schemaMask = 0;
+    for(const auto& component : mSchema.mComponents) schemaMask |= component.mask;
+
+    // Removals first, they are tiny. Entities that were destroyed are not relevant anymore either.
+    // Removals that were not acknowledged yet are sent again, the datagram might have been lost.
+    std::vector<EntityId> removed, candidates;
+    for(EntityId entityId = 0; entityId < client.relevant.size(); ++entityId) {
+        const auto relevant = client.relevant[entityId] && mWorld.isValid(entityId)
+            && (mWorld.getComponentMask(entityId) & schemaMask) > 0;
+        if(relevant) {
+            candidates.push_back(entityId);
+        } else {
+            if(client.known[entityId] != Unknown) removed.push_back(entityId);
+            client.priority[entityId] = 0.0f;
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [&client](EntityId a, EntityId b) {
+        return client.priority[a] > client.priority[b];
+    });
+
+    std::vector<uint8_t> datagram, entry;
+    uint16_t entryCount = 0;
+    size_t sentBytes = 0;
+    auto beginDatagram = [&]() {
+        datagram.clear();
+        ByteWriter writer(datagram);
+        writer.write(STATE_MAGIC);
+        writer.write(mTick);
+        writer.write(uint16_t(0)); // entry count, set when sending
+        entryCount = 0;
+    };
+    auto sendDatagram = [&]() {
+        if(entryCount == 0) return;
+        std::memcpy(datagram.data() + sizeof(uint32_t) * 2, &entryCount, sizeof(entryCount));
+        sendto(mSocket, datagram.data(), datagram.size(), 0,
+            reinterpret_cast<const sockaddr*>(&client.address), sizeof(client.address));
+        sentBytes += datagram.size();
+    };
+    // returns false if the budget is used up
+    auto addEntry = [&]() {
+        if(sentBytes + datagram.size() + entry.size() > mConfig.bytesPerTick) return false;
+        if(datagram.size() + entry.size() > mConfig.maxDatagramSize || entryCount == UINT16_MAX) {
+            sendDatagram();
+            beginDatagram();
+        }
+        datagram.insert(datagram.end(), entry.begin(), entry.end());
+        entryCount++;
+        return true;
+    };
+
+    beginDatagram();
+    for(const auto entityId : removed) {
+        entry.clear();
+        ByteWriter writer(entry);
+        writer.write(entityId);
+        writer.write(uint32_t(0));
+        writer.write(uint16_t(0));
+        if(!addEntry()) break;
+        client.known[entityId] = Removing;
+    }
+    for(const auto entityId : candidates) {
+        entry.clear();
+        ByteWriter writer(entry);
+        writer.write(entityId);
+        const auto mask = mWorld.getComponentMask(entityId);
+        uint32_t present = 0;
+        for(size_t i = 0; i < mSchema.mComponents.size(); ++i) {
+            if(mask & mSchema.mComponents[i].mask) present |= 1u << i;
+        }
+        writer.write(present);
+        writer.write(uint16_t(0));
+        const auto payloadOffset = entry.size();
+        for(size_t i = 0; i < mSchema.mComponents.size(); ++i) {
+            if(present & (1u << i)) mSchema.mComponents[i].encode(mWorld, entityId, writer);
+        }
+        const auto payloadSize = static_cast<uint16_t>(entry.size() - payloadOffset);
+        std::memcpy(entry.data() + payloadOffset - sizeof(payloadSize), &payloadSize, sizeof(payloadSize));
+        assert(entry.size() + STATE_HEADER_SIZE <= mConfig.maxDatagramSize && "Entity does not fit into a datagram");
+        if(!addEntry()) break;
+        client.known[entityId] = Sent;
+        client.priority[entityId] = 0.0f;
+    }
+    sendDatagram();
+}
+
+
+ReplicationClient::ReplicationClient(World& world, const ReplicationSchema& schema, const std::string& host, uint16_t port) :
+        mWorld(world), mSchema(schema), mSocket(openSocket()) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    const auto resolved = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+    if(resolved != 0 || !result) {
+        close(mSocket);
+        throw std::runtime_error("getaddrinfo " + host + ": " + gai_strerror(resolved));
+    }
+    // connect, so we only receive datagrams from the server and can use send
+    const auto connected = connect(mSocket, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+    if(connected != 0) closeAndThrow(mSocket, "connect to " + host + ":" + std::to_string(port));
+}
+
+ReplicationClient::~ReplicationClient() {
+    close(mSocket);
+}
+
+void ReplicationClient::sendViewer(const ReplicationPosition& position, float radius) {
+    const ViewerMessage message{VIEWER_MAGIC, position, radius};
+    send(mSocket, &message, sizeof(message), 0);
+}
+
+size_t ReplicationClient::update() {
+    std::vector<uint8_t> buffer(MAX_DATAGRAM_SIZE);
+    size_t count = 0;
+    while(true) {
+        const auto size = recv(mSocket, buffer.data(), buffer.size(), 0);
+        if(size < 0) break;
+        apply(buffer.data(), size);
+        count++;
+    }
+
+    // the server sends removals until they are acknowledged, so lost acknowledgements are just sent again next time
+    for(size_t begin = 0; begin < mRemovalAcks.size(); begin += MAX_REMOVAL_ACKS) {
+        const auto end = std::min(mRemovalAcks.size(), begin + MAX_REMOVAL_ACKS);
+        buffer.clear();
+        ByteWriter writer(buffer);
+        writer.write(REMOVAL_ACK_MAGIC);
+        writer.write(static_cast<uint16_t>(end - begin));
+        for(size_t i = begin; i < end; ++i) writer.write(mRemovalAcks[i]);
+        send(mSocket, buffer.data(), buffer.size(), 0);
+    }
+    mRemovalAcks.clear();
+    return count;
+}
+
+void ReplicationClient::apply(const uint8_t* data, size_t size) {
+    ByteReader reader(data, size);
+    if(reader.read<uint32_t>() != STATE_MAGIC) return;
+    const auto tick = reader.read<uint32_t>();
+    const auto entryCount = reader.read<uint16_t>();
+    for(uint16_t i = 0; i < entryCount && !reader.failed(); ++i) {
+        const auto serverEntity = reader.read<EntityId>();
+        const auto present = reader.read<uint32_t>();
+        const auto payloadSize = reader.read<uint16_t>();
+        if(reader.failed()) return;
+
+        auto it = mEntities.find(serverEntity);
+        if(it != mEntities.end() && it->second.tick > tick) {
+            // we already applied a newer state (the datagrams were reordered)
+            reader.skip(payloadSize);
+            continue;
+        }
+
+        if(present == 0) {
+            // Keep the tick, so an older state that arrives late doesn't bring the entity back
+            if(it == mEntities.end()) it = mEntities.emplace(serverEntity, RemoteEntity{INVALID_ENTITY, tick}).first;
+            if(it->second.local != INVALID_ENTITY) mWorld.destroyEntity(it->second.local);
+            it->second.local = INVALID_ENTITY;
+            it->second.tick = tick;
+            mRemovalAcks.push_back(serverEntity);
+            continue;
+        }
+
+        if(it == mEntities.end()) it = mEntities.emplace(serverEntity, RemoteEntity{INVALID_ENTITY, tick}).first;
+        if(it->second.local == INVALID_ENTITY) it->second.local = mWorld.createEntity().getId();
+        it->second.tick = tick;
+        const auto local = it->second.local;
+        for(size_t c = 0; c < mSchema.mComponents.size(); ++c) {
+            if(present & (1u << c)) {
+                mSchema.mComponents[c].decode(mWorld, local, reader);
+            } else {
+                mSchema.mComponents[c].remove(mWorld, local);
+            }
+        }
+        mWorld.flush(local);
+    }
+}
+
+EntityId ReplicationClient::getLocalEntity(EntityId serverEntity) const {
+    const auto it = mEntities.find(serverEntity);
+    return it != mEntities.end() ? it->second.local : INVALID_ENTITY;
+}
+
+} // namespace ecs
@@ -0,0 +1,209 @@
+// Runs a ReplicationServer and a ReplicationClient over localhost and checks that the client ends up with exactly
+// the entities around its viewer and their current state, even if datagrams with removals are lost. Usage: repltest
+#include <cstdio>
+#include <cmath>
+#include <cerrno>
+#include <thread>
+#include <chrono>
+#include <system_error>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "replication.hpp"
+
+namespace {
+
+struct CTransform {
+    float x, y, z;
+};
+
+struct CHealth {
+    int32_t value;
+};
+
+const float worldSize = 200.0f;
+const int gridSize = 20; // entities per row, spaced worldSize / gridSize apart
+
+ecs::ReplicationSchema makeSchema() {
+    ecs::ReplicationSchema schema;
+    schema.add<CTransform>([](const CTransform& t, ecs::ByteWriter& writer) {
+        writer.writeQuantized(t.x, 0.0f, worldSize);
+        writer.writeQuantized(t.y, 0.0f, worldSize);
+        writer.writeQuantized(t.z, 0.0f, worldSize);
+    }, [](ecs::ByteReader& reader) {
+        CTransform t;
+        t.x = reader.readQuantized(0.0f, worldSize);
+        t.y = reader.readQuantized(0.0f, worldSize);
+        t.z = reader.readQuantized(0.0f, worldSize);
+        return t;
+    });
+    schema.add<CHealth>();
+    return schema;
+}
+
+// Relays the datagrams between the client and the server, so it can lose some of them
+class LossyProxy {
+public:
+    explicit LossyProxy(uint16_t serverPort) : mSocket(socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) {
+        if(mSocket < 0) throw std::system_error(errno, std::generic_category(), "socket");
+        mServer.sin_family = AF_INET;
+        mServer.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        mServer.sin_port = htons(serverPort);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if(bind(mSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+                || getsockname(mSocket, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            close(mSocket);
+            throw std::system_error(errno, std::generic_category(), "bind proxy");
+        }
+        mPort = ntohs(address.sin_port);
+    }
+
+    ~LossyProxy() { close(mSocket); }
+
+    uint16_t getPort() const { return mPort; }
+
+    // drops the next count datagrams from the server that contain a removal
+    void dropRemovals(int count) { mDropRemovals = count; }
+    int getDropped() const { return mDropped; }
+
+    // forwards everything received so far
+    void relay() {
+        uint8_t buffer[65536];
+        sockaddr_in from;
+        while(true) {
+            socklen_t length = sizeof(from);
+            const auto size = recvfrom(mSocket, buffer, sizeof(buffer), 0, reinterpret_cast<sockaddr*>(&from), &length);
+            if(size < 0) break;
+            if(from.sin_port != mServer.sin_port) {
+                mClient = from;
+                sendto(mSocket, buffer, size, 0, reinterpret_cast<const sockaddr*>(&mServer), sizeof(mServer));
+            } else if(mDropRemovals > 0 && containsRemoval(buffer, size)) {
+                mDropRemovals--;
+                mDropped++;
+            } else {
+                sendto(mSocket, buffer, size, 0, reinterpret_cast<const sockaddr*>(&mClient), sizeof(mClient));
+            }
+        }
+    }
+
+private:
+    // see the datagram format in replication.cpp
+    static bool containsRemoval(const uint8_t* data, size_t size) {
+        ecs::ByteReader reader(data, size);
+        reader.read<uint32_t>(); // magic
+        reader.read<uint32_t>(); // tick
+        const auto count = reader.read<uint16_t>();
+        for(uint16_t i = 0; i < count && !reader.failed(); ++i) {
+            reader.read<ecs::EntityId>();
+            const auto present = reader.read<uint32_t>();
+            reader.skip(reader.read<uint16_t>());
+            if(present == 0 && !reader.failed()) return true;
+        }
+        return false;
+    }
+
+    int mSocket;
+    uint16_t mPort = 0;
+    sockaddr_in mServer{}, mClient{};
+    int mDropRemovals = 0, mDropped = 0;
+};
+
+// returns the number of mismatches between the relevant server entities and the client's entities
+int check(ecs::World& server, ecs::World& client, const ecs::ReplicationClient& replication,
+          const ecs::ReplicationPosition& viewer, float radius, int32_t minHealth) {
+    int errors = 0;
+    size_t relevant = 0;
+    for(ecs::EntityId entityId = 0; entityId < server.getEntityCount(); ++entityId) {
+        const auto& t = server.getComponent<const CTransform>(entityId);
+        const auto inside = std::hypot(t.x - viewer.x, t.y - viewer.y, t.z - viewer.z) <= radius;
+        const auto local = replication.getLocalEntity(entityId);
+        if(!inside) {
+            if(local != ecs::INVALID_ENTITY) errors++;
+            continue;
+        }
+        relevant++;
+        if(local == ecs::INVALID_ENTITY || !client.hasComponents<CTransform, CHealth>(local)) {
+            errors++;
+            continue;
+        }
+        const auto& received = client.getComponent<const CTransform>(local);
+        const auto tolerance = worldSize / 65535.0f;
+        if(std::abs(received.x - t.x) > tolerance || std::abs(received.y - t.y) > tolerance) errors++;
+        if(client.getComponent<const CHealth>(local).value < minHealth) errors++;
+    }
+    std::printf("viewer (%.0f, %.0f): %zu relevant entities, %d mismatches\n", viewer.x, viewer.y, relevant, errors);
+    return errors;
+}
+
+} // namespace
+
+int main() {
+    const auto schema = makeSchema();
+
+    ecs::World serverWorld;
+    for(int i = 0; i < gridSize * gridSize; ++i) {
+        const auto spacing = worldSize / gridSize;
+        auto e = serverWorld.createEntity();
+        e.add<CTransform>(CTransform{(i % gridSize) * spacing, (i / gridSize) * spacing, 0.0f});
+        e.add<CHealth>(CHealth{0});
+    }
+    serverWorld.flush();
+
+    ecs::ReplicationServer::Config config;
+    config.port = 0; // any free port
+    config.bytesPerTick = 1024; // less than all relevant entities, so they have to take turns
+    ecs::ReplicationServer server(serverWorld, schema, config);
+    server.setPosition<CTransform>([](const CTransform& t) { return ecs::ReplicationPosition{t.x, t.y, t.z}; });
+
+    // a second server can't bind the same port
+    try {
+        config.port = server.getPort();
+        ecs::ReplicationServer other(serverWorld, schema, config);
+        std::printf("binding a used port did not fail\n");
+        return 1;
+    } catch(const std::system_error& error) {
+        std::printf("second server: %s\n", error.what());
+    }
+
+    LossyProxy proxy(server.getPort());
+    ecs::World clientWorld;
+    ecs::ReplicationClient client(clientWorld, schema, "127.0.0.1", proxy.getPort());
+
+    int errors = 0;
+    int32_t tick = 0;
+    auto run = [&](const ecs::ReplicationPosition& viewer, float radius, int ticks) {
+        for(int i = 0; i < ticks; ++i) {
+            tick++;
+            serverWorld.tickSystem<CHealth>(false, true, [tick](CHealth& health) { health.value = tick; });
+            serverWorld.finishTick();
+            client.sendViewer(viewer, radius);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            proxy.relay();
+            server.update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            proxy.relay();
+            client.update();
+            clientWorld.finishTick();
+        }
+        // every relevant entity is sent at least every few ticks with this budget
+        errors += check(serverWorld, clientWorld, client, viewer, radius, tick - 20);
+    };
+    run({55.0f, 52.0f, 0.0f}, 40.5f, 100);
+    // the entities around the old viewer have to be removed
+    run({150.5f, 121.0f, 0.0f}, 50.5f, 100);
+    // and they have to be removed as well if the removals get lost, they are sent until they are acknowledged
+    proxy.dropRemovals(3);
+    run({55.0f, 52.0f, 0.0f}, 40.5f, 100);
+    if(proxy.getDropped() != 3) {
+        std::printf("dropped %d datagrams with removals instead of 3\n", proxy.getDropped());
+        errors++;
+    }
+
+    std::printf("%s\n", errors == 0 ? "ok" : "failed");
+    return errors == 0 ? 0 : 1;
+}
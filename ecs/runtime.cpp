@@ -0,0 +1,66 @@
+#include "runtime.hpp"
+
+#include <chrono>
+
+namespace ecs {
+
+Runtime::Runtime(std::shared_ptr<WorkerPool> pool) : mWorkerPool(std::move(pool)) {
+    assert(mWorkerPool);
+}
+
+Runtime::WorldId Runtime::createWorld(StepFunc step) {
+    auto entry = std::make_unique<Entry>();
+    entry->world = std::make_unique<World>(mWorkerPool);
+    entry->step = std::move(step);
+    mWorlds.push_back(std::move(entry));
+    return mWorlds.size() - 1;
+}
+
+void Runtime::destroyWorld(WorldId id) {
+    assert(id < mWorlds.size() && mWorlds[id]);
+    mWorlds[id].reset();
+}
+
+World& Runtime::getWorld(WorldId id) {
+    assert(id < mWorlds.size() && mWorlds[id]);
+    return *mWorlds[id]->world;
+}
+
+const Runtime::FrameStats& Runtime::getStats(WorldId id) const {
+    assert(id < mWorlds.size() && mWorlds[id]);
+    return mWorlds[id]->stats;
+}
+
+void Runtime::stepAll() {
+    std::vector<Entry*> order;
+    for(auto& entry : mWorlds) {
+        if(entry) order.push_back(entry.get());
+    }
+    std::stable_sort(order.begin(), order.end(), [](const Entry* a, const Entry* b) {
+        return a->stats.lastFrameSeconds > b->stats.lastFrameSeconds;
+    });
+
+    // Chunks of one world are claimed in order by the workers and this thread. The jobs are ours, so workers waiting
+    // inside a world's step don't pick up the step of another world (see WorkerPool::runPendingJob).
+    mWorkerPool->parallelFor(order.size(), 1, [&order](size_t begin, size_t end) {
+        for(auto i = begin; i < end; ++i) {
+            auto& entry = *order[i];
+            const auto start = std::chrono::steady_clock::now();
+            entry.step(*entry.world);
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            entry.stats.frames++;
+            entry.stats.lastFrameSeconds = seconds;
+            entry.stats.maxFrameSeconds = std::max(entry.stats.maxFrameSeconds, seconds);
+            entry.stats.totalSeconds += seconds;
+        }
+    }, this);
+
+    // all worlds are between ticks now
+    mMigrations.clear();
+    for(auto entry : order) {
+        const auto migrations = entry->world->migrateQueued();
+        mMigrations.insert(mMigrations.end(), migrations.begin(), migrations.end());
+    }
+}
+
+} // namespace ecs
@@ -0,0 +1,152 @@
+#include "shmexport.hpp"
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ecs {
+
+namespace {
+    size_t alignOffset(size_t offset) {
+        // cache line aligned, so the arrays don't share lines with each other
+        return (offset + 63) / 64 * 64;
+    }
+}
+
+SharedWorldExport::SharedWorldExport(const std::string& name, size_t maxEntities) :
+    mName(name), mCapacity(maxEntities) {}
+
+SharedWorldExport::~SharedWorldExport() {
+    if(!mRegion) return;
+    munmap(mRegion, mSize);
+    // readers that still have it mapped can keep using it
+    shm_unlink(mName.c_str());
+}
+
+void SharedWorldExport::createRegion() {
+    auto offset = alignOffset(sizeof(shm::Header));
+    const auto masksOffset = offset;
+    offset = alignOffset(offset + mCapacity * sizeof(ComponentMask));
+    const auto validOffset = offset;
+    offset = alignOffset(offset + (mCapacity + 63) / 64 * sizeof(uint64_t));
+    std::vector<size_t> componentOffsets;
+    for(const auto& component : mComponents) {
+        componentOffsets.push_back(offset);
+        offset = alignOffset(offset + mCapacity * component.size);
+    }
+    mSize = offset;
+
+    const auto fd = shm_open(mName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if(fd < 0) throw std::system_error(errno, std::generic_category(), "shm_open " + mName);
+    auto fail = [this, fd](const char* what) {
+        const auto error = errno;
+        close(fd);
+        shm_unlink(mName.c_str());
+        throw std::system_error(error, std::generic_category(), what + (" " + mName));
+    };
+    if(ftruncate(fd, mSize) != 0) fail("ftruncate");
+    auto region = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(region == MAP_FAILED) fail("mmap");
+    close(fd);
+    mRegion = static_cast<uint8_t*>(region);
+
+    // the region is zero filled, so no entity is valid yet
+    auto header = new(mRegion) shm::Header();
+    header->componentCount = mComponents.size();
+    header->capacity = mCapacity;
+    header->size = mSize;
+    header->sequence.store(0, std::memory_order_relaxed);
+    header->masksOffset = masksOffset;
+    header->validOffset = validOffset;
+    for(size_t i = 0; i < mComponents.size(); ++i) {
+        auto& info = header->components[i];
+        std::strncpy(info.name, mComponents[i].name.c_str(), shm::MAX_NAME_LENGTH - 1);
+        info.mask = mComponents[i].mask;
+        info.size = mComponents[i].size;
+        info.offset = componentOffsets[i];
+    }
+    header->magic.store(shm::MAGIC, std::memory_order_release);
+}
+
+void SharedWorldExport::publish(World& world) {
+    if(!mRegion) createRegion();
+    auto& header = *reinterpret_cast<shm::Header*>(mRegion);
+
+    const auto sequence = header.sequence.load(std::memory_order_relaxed);
+    header.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const auto entityCount = std::min(world.getEntityCount(), mCapacity);
+    auto masks = reinterpret_cast<ComponentMask*>(mRegion + header.masksOffset);
+    auto valid = reinterpret_cast<uint64_t*>(mRegion + header.validOffset);
+    std::memset(valid, 0, (mCapacity + 63) / 64 * sizeof(uint64_t));
+    for(size_t entityId = 0; entityId < entityCount; ++entityId) {
+        masks[entityId] = world.getComponentMask(entityId);
+        if(world.isValid(entityId)) valid[entityId / 64] |= uint64_t(1) << (entityId % 64);
+    }
+    for(size_t i = 0; i < mComponents.size(); ++i) {
+        mComponents[i].copy(world, mRegion + header.components[i].offset, mCapacity);
+    }
+    header.entityCount = entityCount;
+    header.frame++;
+
+    header.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+uint64_t SharedWorldExport::getFrame() const {
+    return mRegion ? reinterpret_cast<const shm::Header*>(mRegion)->frame : 0;
+}
+
+
+SharedWorldReader::SharedWorldReader(const std::string& name) {
+    const auto fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) return;
+    struct stat info;
+    if(fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(shm::Header)) {
+        auto region = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(region != MAP_FAILED) {
+            mRegion = static_cast<const uint8_t*>(region);
+            mSize = info.st_size;
+        }
+    }
+    close(fd);
+
+    // not initialized yet or something else entirely
+    if(mRegion && (getHeader().magic.load(std::memory_order_acquire) != shm::MAGIC || getHeader().size != mSize)) {
+        munmap(const_cast<uint8_t*>(mRegion), mSize);
+        mRegion = nullptr;
+    }
+}
+
+SharedWorldReader::~SharedWorldReader() {
+    if(mRegion) munmap(const_cast<uint8_t*>(mRegion), mSize);
+}
+
+bool SharedWorldReader::Snapshot::isValid(EntityId entityId) const {
+    assert(entityId < getEntityCount());
+    const auto valid = reinterpret_cast<const uint64_t*>(mRegion + mHeader.validOffset);
+    return (valid[entityId / 64] >> (entityId % 64)) & 1;
+}
+
+ComponentMask SharedWorldReader::Snapshot::getComponentMask(EntityId entityId) const {
+    assert(entityId < getEntityCount());
+    return reinterpret_cast<const ComponentMask*>(mRegion + mHeader.masksOffset)[entityId];
+}
+
+int SharedWorldReader::Snapshot::findComponent(const std::string& name) const {
+    for(size_t i = 0; i < std::min<size_t>(mHeader.componentCount, shm::MAX_COMPONENTS); ++i) {
+        if(std::strncmp(mHeader.components[i].name, name.c_str(), shm::MAX_NAME_LENGTH) == 0) return i;
+    }
+    return -1;
+}
+
+bool SharedWorldReader::Snapshot::hasComponent(EntityId entityId, int component) const {
+    assert(component >= 0 && static_cast<size_t>(component) < mHeader.componentCount);
+    return (getComponentMask(entityId) & mHeader.components[component].mask) > 0;
+}
+
+} // namespace ecs
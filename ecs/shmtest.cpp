@@ -0,0 +1,121 @@
+// Publishes a world from a child process and reads it from this one with SharedWorldReader, checking that every
+// snapshot is consistent. Usage: shmtest [frames]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <memory>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "shmexport.hpp"
+
+namespace {
+
+// every entity has the number of the snapshot it was published in, so a torn snapshot has different values
+struct CFrame {
+    uint64_t value;
+};
+
+struct CPosition {
+    float x, y;
+};
+
+const size_t entityCount = 50000;
+
+int runWriter(const std::string& name, size_t frames) {
+    ecs::World world;
+    for(size_t i = 0; i < entityCount; ++i) {
+        auto e = world.createEntity();
+        e.add<CFrame>(CFrame{0});
+        if(i % 2 == 0) e.add<CPosition>(CPosition{float(i), 0.f});
+    }
+    world.flush();
+
+    ecs::SharedWorldExport exporter(name, entityCount);
+    exporter.exportComponent<CFrame>("frame");
+    exporter.exportComponent<CPosition>("position");
+    for(size_t frame = 1; frame <= frames; ++frame) {
+        world.tickSystem<CFrame>(false, true, [frame](CFrame& c) { c.value = frame; });
+        world.tickSystem<CPosition>(false, true, [](CPosition& p) { p.y += 1.f; });
+        world.finishTick();
+        exporter.publish(world);
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    // keep the object around until the reader has seen the last snapshot
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    return 0;
+}
+
+int runReader(const std::string& name, size_t frames) {
+    const auto start = std::chrono::steady_clock::now();
+    auto timedOut = [start]() { return std::chrono::steady_clock::now() - start > std::chrono::seconds(10); };
+
+    // the writer creates the object with the first publish
+    std::unique_ptr<ecs::SharedWorldReader> reader;
+    while(!reader || !reader->isOpen()) {
+        if(timedOut()) {
+            std::printf("shared memory object %s was not created\n", name.c_str());
+            return 1;
+        }
+        reader = std::make_unique<ecs::SharedWorldReader>(name);
+    }
+
+    size_t snapshots = 0, errors = 0;
+    uint64_t lastFrame = 0;
+    while(lastFrame < frames && !timedOut()) {
+        // read calls the function again if the snapshot was torn, so only the errors of the last call count
+        size_t snapshotErrors = 0;
+        const auto frame = reader->read([&](const ecs::SharedWorldReader::Snapshot& snapshot) {
+            auto& errors = snapshotErrors;
+            errors = 0;
+            const auto frameComponent = snapshot.findComponent("frame");
+            const auto positionComponent = snapshot.findComponent("position");
+            if(frameComponent < 0 || positionComponent < 0 || snapshot.getEntityCount() != entityCount) {
+                errors++;
+                return;
+            }
+            for(ecs::EntityId entityId = 0; entityId < snapshot.getEntityCount(); ++entityId) {
+                if(!snapshot.isValid(entityId) || !snapshot.hasComponent(entityId, frameComponent)) continue;
+                const auto value = snapshot.get<CFrame>(entityId, frameComponent).value;
+                const auto position = snapshot.hasComponent(entityId, positionComponent)
+                    ? &snapshot.get<CPosition>(entityId, positionComponent) : nullptr;
+                if(value != snapshot.getFrame() || (position && position->y != float(value))) errors++;
+            }
+        });
+        errors += snapshotErrors;
+        if(frame != lastFrame) {
+            snapshots++;
+            lastFrame = frame;
+        }
+    }
+
+    std::printf("read %zu snapshots, last frame %llu, %zu inconsistent entities\n", snapshots,
+        static_cast<unsigned long long>(lastFrame), errors);
+    return errors == 0 && lastFrame == frames ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const size_t frames = argc > 1 ? std::max(1, std::atoi(argv[1])) : 500;
+    const auto name = "/ecs-shmtest-" + std::to_string(getpid());
+
+    const auto pid = fork();
+    if(pid < 0) {
+        std::perror("fork");
+        return 1;
+    }
+    if(pid == 0) return runWriter(name, frames);
+
+    const auto result = runReader(name, frames);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::printf("writer failed\n");
+        return 1;
+    }
+    return result;
+}
@@ -0,0 +1,172 @@
+#include "streaming.hpp"
+
+#include <fstream>
+#include <algorithm>
+
+namespace ecs {
+
+LevelStreamer::LevelStreamer(World& world) : mWorld(world), mIoThread(&LevelStreamer::ioMain, this) {}
+
+LevelStreamer::~LevelStreamer() {
+    {
+        std::lock_guard lock(mReadMutex);
+        mQuit = true;
+    }
+    mReadCondition.notify_all();
+    mIoThread.join();
+    // reads that were not started yet were completed by the I/O thread, but deserialization might still be running
+    std::vector<SystemHandle> handles;
+    {
+        std::lock_guard lock(mMutex);
+        for(auto& [id, region] : mRegions) handles.push_back(region.handle);
+        handles.insert(handles.end(), mDiscardedLoads.begin(), mDiscardedLoads.end());
+    }
+    waitAll(handles);
+}
+
+bool LevelStreamer::save(const std::string& path, const std::vector<EntityId>& entities) {
+    assert(mSerialize && "No components set");
+    std::vector<uint8_t> data;
+    mSerialize(mWorld, entities, data);
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+    file.close();
+    return !file.fail();
+}
+
+SystemHandle LevelStreamer::load(RegionId region, const std::string& path) {
+    assert(mDeserialize && "No components set");
+    auto handle = SystemHandle::pending();
+    uint64_t load = 0;
+    {
+        std::lock_guard lock(mMutex);
+        auto it = mRegions.find(region);
+        assert((it == mRegions.end() || it->second.state == State::Failed) && "Region is already loaded");
+        if(it != mRegions.end()) mRegions.erase(it);
+        load = ++mLoadCount;
+        mRegions.emplace(region, Region{State::Loading, nullptr, {}, handle, load});
+    }
+    {
+        std::lock_guard lock(mReadMutex);
+        mReads.push_back(Read{region, load, handle, path});
+    }
+    mReadCondition.notify_one();
+    return handle;
+}
+
+void LevelStreamer::ioMain() {
+    // Reads are blocking, so they get a thread of their own instead of stalling a worker
+    while(true) {
+        Read read;
+        {
+            std::unique_lock lock(mReadMutex);
+            mReadCondition.wait(lock, [this]() { return mQuit || !mReads.empty(); });
+            if(mReads.empty()) return;
+            if(mQuit) {
+                // give up on the rest, but don't leave anyone waiting
+                for(auto& pending : mReads) stage(pending, {});
+                mReads.clear();
+                return;
+            }
+            read = std::move(mReads.front());
+            mReads.pop_front();
+        }
+
+        std::vector<uint8_t> data;
+        std::ifstream file(read.path, std::ios::binary | std::ios::ate);
+        if(file) {
+            data.resize(file.tellg());
+            file.seekg(0);
+            file.read(reinterpret_cast<char*>(data.data()), data.size());
+            if(!file) data.clear();
+        }
+
+        mWorld.getWorkerPool().submit([this, read = std::move(read), data = std::move(data)]() mutable {
+            stage(read, std::move(data));
+        });
+    }
+}
+
+void LevelStreamer::stage(const Read& read, std::vector<uint8_t> data) {
+    // a world of its own, so nothing here needs to synchronize with the systems of the actual world
+    auto staging = std::make_unique<World>(mWorld.getSharedWorkerPool());
+    // nothing is staged if the file couldn't be read or is corrupt
+    auto entities = data.empty() ? std::nullopt : mDeserialize(*staging, data.data(), data.size());
+    const auto failed = !entities;
+
+    {
+        std::lock_guard lock(mMutex);
+        // if the region was unloaded while loading, the entry is gone or belongs to a newer load
+        auto it = mRegions.find(read.region);
+        if(it != mRegions.end() && it->second.load == read.load) {
+            it->second.state = failed ? State::Failed : State::Staged;
+            it->second.staging = failed ? nullptr : std::move(staging);
+            it->second.entities = failed ? std::vector<EntityId>() : std::move(*entities);
+        }
+    }
+    // might destroy the staging world, if it was discarded
+    staging.reset();
+    auto handle = read.handle;
+    handle.complete();
+}
+
+std::vector<LevelStreamer::RegionId> LevelStreamer::sync() {
+    std::vector<std::pair<RegionId, Region*>> staged;
+    {
+        std::lock_guard lock(mMutex);
+        for(auto& [id, region] : mRegions) {
+            if(region.state == State::Staged) staged.emplace_back(id, &region);
+        }
+        mDiscardedLoads.erase(std::remove_if(mDiscardedLoads.begin(), mDiscardedLoads.end(),
+            [](const SystemHandle& handle) { return handle.isDone(); }), mDiscardedLoads.end());
+    }
+
+    // Staged regions are only touched by us from now on, so we don't need to hold the lock while migrating.
+    // Pointers into the map stay valid, since only this thread inserts or erases.
+    std::vector<RegionId> loaded;
+    for(auto [id, region] : staged) {
+        region->entities = region->staging->migrate(region->entities, mWorld);
+        region->staging.reset();
+        std::lock_guard lock(mMutex);
+        region->state = State::Loaded;
+        loaded.push_back(id);
+    }
+    return loaded;
+}
+
+void LevelStreamer::unload(RegionId region) {
+    std::unique_lock lock(mMutex);
+    auto it = mRegions.find(region);
+    assert(it != mRegions.end() && "Region is not loaded");
+    if(it->second.state == State::Loaded) {
+        const auto entities = std::move(it->second.entities);
+        mRegions.erase(it);
+        lock.unlock();
+        mWorld.destroyEntities(entities);
+    } else {
+        // if it is still loading, stage drops the result, but we have to wait for it before we are destroyed
+        if(it->second.state == State::Loading) mDiscardedLoads.push_back(it->second.handle);
+        mRegions.erase(it);
+    }
+}
+
+bool LevelStreamer::isLoaded(RegionId region) const {
+    std::lock_guard lock(mMutex);
+    const auto it = mRegions.find(region);
+    return it != mRegions.end() && it->second.state == State::Loaded;
+}
+
+bool LevelStreamer::hasFailed(RegionId region) const {
+    std::lock_guard lock(mMutex);
+    const auto it = mRegions.find(region);
+    return it != mRegions.end() && it->second.state == State::Failed;
+}
+
+const std::vector<EntityId>& LevelStreamer::getEntities(RegionId region) const {
+    std::lock_guard lock(mMutex);
+    const auto& entry = mRegions.at(region);
+    assert(entry.state == State::Loaded);
+    return entry.entities;
+}
+
+} // namespace ecs
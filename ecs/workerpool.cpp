@@ -0,0 +1,205 @@
+#include "workerpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+#include "numa.hpp"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+namespace ecs {
+
+namespace {
+    thread_local bool workerThread = false;
+    thread_local size_t workerNode = 0;
+
+    // returns whether the thread could be pinned to the CPUs (if there are any)
+    bool configureThread(std::thread& thread, const std::string& name, const std::vector<int>& cpus) {
+#ifdef __linux__
+        if(!name.empty()) pthread_setname_np(thread.native_handle(), name.substr(0, 15).c_str());
+        if(cpus.empty()) return true;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for(auto cpu : cpus) {
+            if(cpu < 0 || cpu >= CPU_SETSIZE) return false;
+            CPU_SET(cpu, &set);
+        }
+        return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+        return cpus.empty();
+#endif
+    }
+
+    // the node of a worker or the one the calling thread is running on
+    size_t getCallerNode(size_t nodeCount) {
+        if(nodeCount == 1) return 0;
+        return (workerThread ? workerNode : numa::getCurrentNode()) % nodeCount;
+    }
+}
+
+WorkerPool::WorkerPool(const ThreadConfig& config) :
+        mConfig(config), mNodeCount(config.numaAware ? numa::getNodeCount() : 1), mJobs(mNodeCount + 1), mStop(false) {
+    if(mConfig.workerCount == 0) mConfig.workerCount = defaultWorkerCount();
+    for(size_t i = 0; i < mConfig.workerCount; ++i) {
+        const auto node = i % mNodeCount;
+        auto& worker = mWorkers.emplace_back(&WorkerPool::workerMain, this, node);
+        const auto& affinity = mConfig.workerAffinity;
+        const auto& cpus = !affinity.empty() ? affinity[i % affinity.size()]
+            : mNodeCount > 1 ? numa::getNodeCpus(node) : std::vector<int>();
+        // from here, so the failures are known when the constructor returns
+        if(!configureThread(worker, mConfig.workerName + std::to_string(i), cpus)) mUnpinnedWorkers++;
+    }
+}
+
+WorkerPool::WorkerPool(size_t workerCount, bool numaAware) : WorkerPool([=]() {
+        ThreadConfig config;
+        config.workerCount = std::max<size_t>(workerCount, 1);
+        config.numaAware = numaAware;
+        return config;
+    }()) {}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard lock(mMutex);
+        mStop = true;
+    }
+    mJobAvailable.notify_all();
+    for(auto& worker : mWorkers) worker.join();
+}
+
+void WorkerPool::submit(std::function<void()> job, const void* owner) {
+    {
+        std::lock_guard lock(mMutex);
+        mJobs.back().push_back(Job{std::move(job), owner});
+    }
+    mJobAvailable.notify_one();
+}
+
+void WorkerPool::parallelFor(size_t count, size_t chunkSize, const std::function<void(size_t, size_t)>& func,
+                             const void* owner) {
+    assert(chunkSize > 0);
+    const auto chunkCount = (count + chunkSize - 1) / chunkSize;
+    if(chunkCount <= 1) {
+        if(count > 0) func(0, count);
+        return;
+    }
+
+    // Chunk c belongs to node c % mNodeCount, so every node has its own counter of claimed chunks.
+    // The state is shared with the helper jobs, which may only start after we have returned. They will not find
+    // any chunks to claim then, so they never touch func after all chunks are done.
+    struct State {
+        const std::function<void(size_t, size_t)>* func;
+        size_t count, chunkSize, chunkCount, nodeCount;
+        std::vector<std::atomic<size_t>> nextChunk;
+        std::atomic<size_t> chunksDone;
+        std::mutex mutex;
+        std::condition_variable allDone;
+
+        State(const std::function<void(size_t, size_t)>* func, size_t count, size_t chunkSize, size_t chunkCount,
+              size_t nodeCount) : func(func), count(count), chunkSize(chunkSize), chunkCount(chunkCount),
+                                  nodeCount(nodeCount), nextChunk(nodeCount), chunksDone(0) {}
+
+        // process chunks of the preferred node first, then help the others
+        void run(size_t preferredNode) {
+            for(size_t i = 0; i < nodeCount; ++i) {
+                const auto node = (preferredNode + i) % nodeCount;
+                while(true) {
+                    const auto chunk = node + nextChunk[node]++ * nodeCount;
+                    if(chunk >= chunkCount) break;
+                    (*func)(chunk * chunkSize, std::min(count, (chunk + 1) * chunkSize));
+                    if(++chunksDone == chunkCount) {
+                        std::lock_guard lock(mutex);
+                        allDone.notify_all();
+                    }
+                }
+            }
+        }
+    };
+    auto state = std::make_shared<State>(&func, count, chunkSize, chunkCount, mNodeCount);
+
+    const auto helpers = std::min(chunkCount - 1, mWorkers.size());
+    {
+        std::lock_guard lock(mMutex);
+        for(size_t i = 0; i < helpers; ++i) {
+            const auto node = i % mNodeCount;
+            mJobs[node].push_back(Job{[state, node]() { state->run(node); }, owner});
+        }
+    }
+    mJobAvailable.notify_all();
+
+    state->run(getCallerNode(mNodeCount));
+    std::unique_lock lock(state->mutex);
+    state->allDone.wait(lock, [&state]() { return state->chunksDone == state->chunkCount; });
+}
+
+bool WorkerPool::runPendingJob(const void* owner) {
+    std::function<void()> job;
+    {
+        std::lock_guard lock(mMutex);
+        if(!popJob(getCallerNode(mNodeCount), job, false, owner)) return false;
+    }
+    job();
+    return true;
+}
+
+bool WorkerPool::isWorkerThread() {
+    return workerThread;
+}
+
+size_t WorkerPool::defaultWorkerCount() {
+    // hardware_concurrency may return 0 if it is not computable
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+std::shared_ptr<WorkerPool> WorkerPool::getDefault() {
+    static auto pool = std::make_shared<WorkerPool>();
+    return pool;
+}
+
+bool WorkerPool::popJob(size_t node, std::function<void()>& job, bool anyOwner, const void* owner) {
+    // own node first, then jobs that may run anywhere, then steal from other nodes
+    auto tryPop = [this, &job, anyOwner, owner](size_t queue) {
+        auto& jobs = mJobs[queue];
+        const auto it = std::find_if(jobs.begin(), jobs.end(), [anyOwner, owner](const Job& job) {
+            return anyOwner || !job.owner || job.owner == owner;
+        });
+        if(it == jobs.end()) return false;
+        job = std::move(it->func);
+        jobs.erase(it);
+        return true;
+    };
+    if(tryPop(node) || tryPop(mNodeCount)) return true;
+    for(size_t i = 1; i < mNodeCount; ++i) {
+        if(tryPop((node + i) % mNodeCount)) return true;
+    }
+    return false;
+}
+
+void WorkerPool::workerMain(size_t node) {
+#ifdef __linux__
+    // on Linux the nice value is per thread
+    if(mConfig.niceness) setpriority(PRIO_PROCESS, syscall(SYS_gettid), *mConfig.niceness);
+#endif
+    workerThread = true;
+    workerNode = node;
+
+    while(true) {
+        std::function<void()> job;
+        {
+            std::unique_lock lock(mMutex);
+            // finish all queued jobs before stopping
+            mJobAvailable.wait(lock, [this, node, &job]() { return popJob(node, job, true) || mStop; });
+            if(!job) return;
+        }
+        job();
+    }
+}
+
+} // namespace ecs
@@ -0,0 +1,566 @@
+// Checks the behaviour of World features that don't need a window or another process. Usage: worldtest
+#include <cstdio>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <bit>
+#include <new>
+#include <limits>
+
+#include "ecs.hpp"
+#include "streaming.hpp"
+#include "perfcounters.hpp"
+#include "compress.hpp"
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+void check(bool condition, const char* expression, int line) {
+    if(!condition) {
+        std::printf("line %d: %s failed\n", line, expression);
+        failures++;
+    }
+}
+
+struct CPosition {
+    float x, y;
+};
+
+struct CRadius {
+    float value;
+};
+
+// positions on a grid with some jitter, so pairs overlap irregularly
+void addCircles(ecs::World& world, size_t count) {
+    for(size_t i = 0; i < count; ++i) {
+        auto e = world.createEntity();
+        e.add<CPosition>(CPosition{float(i % 40) * 3.0f + float(i % 7) * 0.3f, float(i / 40) * 3.0f});
+        if(i % 3 != 0) e.add<CRadius>(CRadius{1.0f + float(i % 5) * 0.4f});
+    }
+    world.flush();
+}
+
+using Overlap = std::pair<ecs::EntityId, ecs::EntityId>;
+
+template <typename ExPo>
+std::vector<Overlap> findOverlaps(ecs::World& world, ExPo&& executionPolicy) {
+    return world.forEachPair<Overlap>(ecs::With<const CPosition, const CRadius>(),
+        [](ecs::EntityHandle a, ecs::EntityHandle b, std::vector<Overlap>& output) {
+            const auto& pa = a.get<const CPosition>(), & pb = b.get<const CPosition>();
+            const auto radius = a.get<const CRadius>().value + b.get<const CRadius>().value;
+            const auto dx = pb.x - pa.x, dy = pb.y - pa.y;
+            if(dx * dx + dy * dy < radius * radius) output.emplace_back(a.getId(), b.getId());
+        }, std::forward<ExPo>(executionPolicy));
+}
+
+template <typename ExPo>
+std::vector<Overlap> findCovered(ecs::World& world, ExPo&& executionPolicy) {
+    // every position covered by a circle (including its own)
+    return world.forEachPair<Overlap>(ecs::With<const CPosition, const CRadius>(), ecs::With<const CPosition>(),
+        [](ecs::EntityHandle a, ecs::EntityHandle b, std::vector<Overlap>& output) {
+            const auto& pa = a.get<const CPosition>(), & pb = b.get<const CPosition>();
+            const auto radius = a.get<const CRadius>().value;
+            const auto dx = pb.x - pa.x, dy = pb.y - pa.y;
+            if(dx * dx + dy * dy < radius * radius) output.emplace_back(a.getId(), b.getId());
+        }, std::forward<ExPo>(executionPolicy));
+}
+
+void testForEachPair() {
+    ecs::World reference(std::make_shared<ecs::WorkerPool>(1));
+    addCircles(reference, 1500);
+    const auto overlaps = findOverlaps(reference, std::execution::seq);
+    const auto covered = findCovered(reference, std::execution::seq);
+    CHECK(!overlaps.empty());
+    CHECK(covered.size() > 1000);
+
+    for(const size_t workers : {1, 3, 8}) {
+        ecs::World world(std::make_shared<ecs::WorkerPool>(workers));
+        addCircles(world, 1500);
+        CHECK(findOverlaps(world, std::execution::seq) == overlaps);
+        CHECK(findOverlaps(world, std::execution::par) == overlaps);
+        CHECK(findOverlaps(world, std::execution::par_unseq) == overlaps);
+        CHECK(findCovered(world, std::execution::par) == covered);
+    }
+}
+
+float sumRadii(ecs::World& world, bool parallel) {
+    // floating point addition isn't associative, so any change of order would change the bits of the result
+    const auto map = [](const CPosition& position, const CRadius& radius) { return position.x * 0.37f + radius.value; };
+    const auto add = [](float a, float b) { return a + b; };
+    return parallel ? world.reduce<const CPosition, const CRadius>(0.0f, map, add, std::execution::par)
+                    : world.reduce<const CPosition, const CRadius>(0.0f, map, add, std::execution::seq);
+}
+
+void testReduce() {
+    ecs::World reference(std::make_shared<ecs::WorkerPool>(1));
+    addCircles(reference, 5000);
+    const auto sum = sumRadii(reference, false);
+    CHECK(sum > 0.0f);
+    const auto count = reference.reduce<const CRadius>(size_t(0), [](ecs::EntityHandle, const CRadius&) { return size_t(1); },
+        [](size_t a, size_t b) { return a + b; }, std::execution::par);
+    CHECK(count == 5000 - 5000 / 3 - 1);
+
+    for(const size_t workers : {1, 3, 8}) {
+        ecs::World world(std::make_shared<ecs::WorkerPool>(workers));
+        addCircles(world, 5000);
+        CHECK(sumRadii(world, false) == sum);
+        CHECK(sumRadii(world, true) == sum);
+    }
+}
+
+void writeFile(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+std::vector<uint8_t> readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void testCorruptRegions() {
+    ecs::World world;
+    ecs::LevelStreamer streamer(world);
+    streamer.setComponents<CPosition, CRadius>();
+    addCircles(world, 100);
+    std::vector<ecs::EntityId> entities;
+    for(ecs::EntityId entityId = 0; entityId < world.getEntityCount(); ++entityId) entities.push_back(entityId);
+
+    const auto path = (std::filesystem::temp_directory_path() / "worldtest-region").string();
+    CHECK(streamer.save(path, entities));
+    const auto valid = readFile(path);
+
+    auto truncated = valid;
+    truncated.resize(truncated.size() - 3);
+    auto hugeCount = valid;
+    hugeCount[3] = 0x7f; // the entity count is stored first
+    auto unknownComponent = valid;
+    unknownComponent[4] |= 4; // the bitmask of the first entity, only two components are stored
+    auto trailing = valid;
+    trailing.push_back(0);
+    const std::vector<std::vector<uint8_t>> corrupt = {truncated, hugeCount, unknownComponent, trailing, {1, 0}};
+
+    ecs::LevelStreamer::RegionId region = 0;
+    for(const auto& data : corrupt) {
+        writeFile(path, data);
+        streamer.load(++region, path).wait();
+        CHECK(streamer.hasFailed(region));
+        CHECK(streamer.sync().empty());
+        CHECK(world.getEntityCount() == 100);
+    }
+
+    writeFile(path, valid);
+    streamer.load(++region, path).wait();
+    CHECK(!streamer.hasFailed(region) && streamer.sync().size() == 1);
+    CHECK(streamer.isLoaded(region) && streamer.getEntities(region).size() == 100);
+    std::filesystem::remove(path);
+}
+
+void testSerialization() {
+    ecs::World world, other;
+    addCircles(world, 300);
+    addCircles(other, 50);
+    const auto empty = world.createEntity().getId();
+    world.flush();
+    // in a different order than their ids and not in the order of the entities
+    std::vector<ecs::EntityId> entities = {empty, 299, 0, 1, 2, 150};
+    std::vector<uint8_t> data;
+    world.serialize<CRadius, CPosition>(entities, data);
+
+    const auto loaded = other.deserialize<CRadius, CPosition>(data.data(), data.size());
+    CHECK(loaded && loaded->size() == entities.size());
+    for(size_t i = 0; loaded && i < entities.size(); ++i) {
+        const auto from = entities[i], to = (*loaded)[i];
+        CHECK(to >= 50 && other.isValid(to));
+        CHECK(other.getComponentMask(to) == world.getComponentMask(from));
+        if(world.hasComponents<CPosition>(from)) {
+            CHECK(other.getComponent<CPosition>(to).x == world.getComponent<CPosition>(from).x);
+            CHECK(other.getComponent<CPosition>(to).y == world.getComponent<CPosition>(from).y);
+        }
+        if(world.hasComponents<CRadius>(from)) {
+            CHECK(other.getComponent<CRadius>(to).value == world.getComponent<CRadius>(from).value);
+        }
+    }
+
+    data.clear();
+    world.serialize<CRadius, CPosition>({}, data);
+    const auto none = other.deserialize<CRadius, CPosition>(data.data(), data.size());
+    CHECK(none && none->empty() && other.getEntityCount() == 50 + entities.size());
+}
+
+size_t countModifiedSince(ecs::World& world, uint64_t tick) {
+    size_t count = 0;
+    world.tickSystem<const CPosition>(ecs::ModifiedSince{tick}, false, false, [&count](const CPosition&) { count++; });
+    return count;
+}
+
+void testModifiedTicks() {
+    ecs::World world, other;
+    addCircles(world, 200);
+    // everything was added in tick 0, which ModifiedSince{0} has to include
+    CHECK(countModifiedSince(world, 0) == 200);
+    CHECK(countModifiedSince(world, 1) == 0);
+    world.finishTick();
+    world.finishTick();
+
+    world.getComponent<CPosition>(10).x = 1.0f;
+    world.removeComponent<CRadius>(11);
+    CHECK(countModifiedSince(world, 2) == 2);
+    CHECK(countModifiedSince(world, 0) == 200);
+
+    world.finishTick();
+    world.destroyEntity(20);
+    world.destroyEntities({21, 22});
+    const auto migrated = world.migrate({23}, other);
+    for(const ecs::EntityId entityId : {20, 21, 22, 23}) CHECK(world.getModifiedTick(entityId) == 3);
+    CHECK(other.getModifiedTick(migrated[0]) == other.getTick());
+    // removed entities are not visited, only marked
+    CHECK(countModifiedSince(world, 3) == 0);
+}
+
+void testSystemHandles() {
+    ecs::World world(std::make_shared<ecs::WorkerPool>(2));
+    addCircles(world, 300);
+
+    // e.g. a file that is still loading
+    auto loaded = ecs::SystemHandle::pending();
+    std::atomic<int> grown = 0;
+    auto grow = world.tickSystemAfter<CRadius>({loaded}, true, false, [&grown](CRadius& radius) {
+        radius.value = 5.0f;
+        grown++;
+    });
+    // conflicts with grow, so it has to wait for it too
+    float sum = 0.0f;
+    auto measure = world.tickSystem<const CRadius>(true, false, [&sum](const CRadius& radius) { sum += radius.value; });
+    // continuations run on the thread completing the handle, so they complete handles of their own to wait for
+    auto grew = ecs::SystemHandle::pending(), bothDone = ecs::SystemHandle::pending();
+    grow.then([grew]() mutable { grew.complete(); });
+    ecs::whenAll({grow, measure}, [bothDone]() mutable { bothDone.complete(); });
+
+    CHECK(!grow.waitFor(std::chrono::milliseconds(20)) && !measure.isDone());
+    CHECK(grown == 0 && !grew.isDone() && !bothDone.isDone());
+    loaded.complete();
+    CHECK(grew.waitFor(std::chrono::seconds(10)) && bothDone.waitFor(std::chrono::seconds(10)));
+    CHECK(grown == 200 && sum == 1000.0f);
+    world.finishTick();
+
+    // already complete, so it's called right away
+    bool called = false;
+    grow.then([&called]() { called = true; });
+    CHECK(called && ecs::SystemHandle().isDone());
+}
+
+std::atomic<bool> windowOpen = false;
+
+ecs::Coroutine growRadius(ecs::World& world, ecs::EntityId entityId) {
+    co_await world.access<CRadius>();
+    windowOpen = true;
+    // a system reading the radius has to wait for this window to close
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    world.getComponent<CRadius>(entityId).value = 10.0f;
+    co_await world.nextFrame();
+    co_await world.access<CRadius>();
+    world.getComponent<CRadius>(entityId).value += 1.0f;
+}
+
+void testCoroutineWindows() {
+    ecs::World world(std::make_shared<ecs::WorkerPool>(2));
+    auto entity = world.createEntity();
+    entity.add<CRadius>(CRadius{1.0f});
+    world.flush();
+
+    const auto done = world.spawn(growRadius(world, entity.getId()));
+    while(!windowOpen) std::this_thread::yield();
+    float radius = 0.0f;
+    world.tickSystem<const CRadius>(false, false, [&radius](const CRadius& r) { radius = r.value; });
+    CHECK(radius == 10.0f);
+    // waiting for the next frame
+    CHECK(!done.waitFor(std::chrono::milliseconds(20)));
+    world.finishTick();
+    done.wait();
+    CHECK(world.getComponent<CRadius>(entity.getId()).value == 11.0f);
+}
+
+struct CUnique {
+    std::unique_ptr<int> value;
+};
+
+void testFork() {
+    ecs::World world;
+    addCircles(world, 3000);
+    auto fork = world.fork();
+    CHECK(fork->getEntityCount() == world.getEntityCount());
+
+    // both through the iteration and through direct access, in blocks that are shared at that point
+    fork->tickSystem<CPosition>(false, false, [](CPosition& position) { position.x += 1000.0f; });
+    world.getComponent<CPosition>(2500).y = -1.0f;
+    fork->destroyEntity(2000);
+    fork->finishTick();
+    for(const ecs::EntityId entityId : {0, 1500, 2500}) {
+        CHECK(world.getComponent<CPosition>(entityId).x < 1000.0f);
+        CHECK(fork->getComponent<CPosition>(entityId).x >= 1000.0f);
+    }
+    CHECK(fork->getComponent<CPosition>(2500).y >= 0.0f);
+    CHECK(world.getComponentMask(2000) != 0 && fork->getComponentMask(2000) == 0);
+
+    // a fork of a fork, which was already written to
+    auto grandchild = fork->fork();
+    grandchild->getComponent<CRadius>(1).value = 100.0f;
+    CHECK(fork->getComponent<CRadius>(1).value < 100.0f && world.getComponent<CRadius>(1).value < 100.0f);
+    grandchild.reset();
+    fork.reset();
+    CHECK(world.getComponent<CPosition>(0).x < 1000.0f);
+
+    world.createEntity().add<CUnique>(CUnique{std::make_unique<int>(1)});
+    world.flush();
+    bool thrown = false;
+    try {
+        world.fork();
+    } catch(const std::logic_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+struct CSmall {
+    static const size_t BLOCK_SIZE = 16;
+    int value;
+};
+
+void testForEachChunk() {
+    ecs::World world(std::make_shared<ecs::WorkerPool>(3));
+    addCircles(world, 1000);
+    for(ecs::EntityId entityId = 0; entityId < world.getEntityCount(); entityId += 2) {
+        world.getEntityHandle(entityId).add<CSmall>(CSmall{int(entityId)});
+    }
+    world.flush();
+
+    const auto positionId = ecs::componentId::get<CPosition>(), smallId = ecs::componentId::get<CSmall>();
+    std::vector<std::atomic<int>> visits(world.getEntityCount());
+    std::atomic<bool> inBounds = true;
+    world.forEachChunk(ecs::componentMask<CPosition>(), ecs::componentMask<CSmall>(), true,
+        [&](const ecs::ColumnChunk& chunk) {
+            // columns are ordered by component id, entities of a chunk never span two blocks of CSmall
+            const auto smallColumn = smallId < positionId ? 0 : 1;
+            const auto last = chunk.begin + 63 - std::countl_zero(chunk.matches);
+            if(chunk.columnCount != 2 || chunk.matches == 0 || chunk.begin / 16 != last / 16) inBounds = false;
+            for(auto matches = chunk.matches; matches; matches &= matches - 1) {
+                const auto i = std::countr_zero(matches);
+                const auto entityId = chunk.begin + i;
+                auto& small = *reinterpret_cast<CSmall*>(chunk.columns[smallColumn] + i * chunk.strides[smallColumn]);
+                auto& position = *reinterpret_cast<CPosition*>(chunk.columns[1 - smallColumn] + i * chunk.strides[1 - smallColumn]);
+                if(&small != &world.getComponent<CSmall>(entityId) || &position != &world.getComponent<CPosition>(entityId)) {
+                    inBounds = false;
+                }
+                visits[entityId]++;
+            }
+        }).wait();
+    CHECK(inBounds);
+    for(ecs::EntityId entityId = 0; entityId < world.getEntityCount(); ++entityId) {
+        CHECK(visits[entityId] == (entityId % 2 == 0 ? 1 : 0));
+    }
+}
+
+void testCompression() {
+    std::vector<std::vector<uint8_t>> inputs = {{7}, std::vector<uint8_t>(70000, 0), {}, {}};
+    for(size_t i = 0; i < 5000; ++i) inputs[2].push_back(uint8_t(i % 13 * 17));
+    uint32_t state = 1;
+    for(size_t i = 0; i < 3000; ++i) inputs[3].push_back(uint8_t((state = state * 1664525 + 1013904223) >> 24));
+    for(const auto& input : inputs) {
+        std::vector<uint8_t> compressed(ecs::lz::maxCompressedSize(input.size())), output(input.size());
+        const auto size = ecs::lz::compress(input.data(), input.size(), compressed.data());
+        CHECK(size <= compressed.size());
+        ecs::lz::decompress(compressed.data(), size, output.data(), output.size());
+        CHECK(output == input);
+    }
+
+    // the radii repeat, so their blocks are compressed and retired, after which they are reclaimed
+    ecs::World world, reference;
+    world.setColdCompression<CRadius>(2);
+    addCircles(world, 2000);
+    addCircles(reference, 2000);
+    for(int i = 0; i < 5; ++i) world.finishTick();
+    CHECK(world.getRetainedBlockMemory() > 0);
+
+    float sum = 0.0f, referenceSum = 0.0f;
+    world.tickSystem<CRadius>(false, true, [&](CRadius& radius) { radius.value *= 2.0f; });
+    world.tickSystem<const CRadius>(false, false, [&](const CRadius& radius) { sum += radius.value; });
+    reference.tickSystem<const CRadius>(false, false, [&](const CRadius& radius) { referenceSum += radius.value * 2.0f; });
+    CHECK(sum == referenceSum);
+    for(int i = 0; i < 5; ++i) world.finishTick(); // compressed again, with the new values
+    for(ecs::EntityId entityId = 1; entityId < 2000; entityId += 3) {
+        CHECK(world.getComponent<CRadius>(entityId).value == reference.getComponent<CRadius>(entityId).value * 2.0f);
+    }
+}
+
+void testBlockReclamation() {
+    ecs::World world;
+    addCircles(world, 256);
+    const auto blockBytes = 64 * (sizeof(CPosition) + sizeof(CRadius));
+    std::vector<ecs::EntityId> first, second;
+    for(ecs::EntityId entityId = 0; entityId < 128; ++entityId) first.push_back(entityId);
+    for(ecs::EntityId entityId = 128; entityId < 256; ++entityId) second.push_back(entityId);
+
+    // systems started before might still read them, so the blocks are only reclaimed in the next finishTick
+    world.destroyEntities(first);
+    CHECK(world.getRetainedBlockMemory() == 0);
+    world.finishTick();
+    CHECK(world.getRetainedBlockMemory() == 2 * blockBytes);
+
+    // beyond the maximum the blocks are freed instead
+    world.setMaxRetainedBlockMemory(2 * blockBytes);
+    world.destroyEntities(second);
+    world.finishTick();
+    CHECK(world.getRetainedBlockMemory() == 2 * blockBytes);
+
+    // new components take retained blocks
+    world.createEntity().add<CPosition>(CPosition{0.0f, 0.0f});
+    CHECK(world.getRetainedBlockMemory() == 2 * blockBytes - 64 * sizeof(CPosition));
+}
+
+struct CName {
+    std::string value;
+};
+
+void testMigration() {
+    ecs::World world, other;
+    addCircles(world, 1000);
+    addCircles(other, 100);
+    std::vector<ecs::EntityId> moved;
+    for(ecs::EntityId entityId = 0; entityId < 1000; entityId += 7) {
+        world.getEntityHandle(entityId).add<CName>(CName{"entity " + std::to_string(entityId)});
+        moved.push_back(entityId);
+    }
+    world.flush();
+    const auto reference = world.fork();
+
+    const auto migrated = world.migrate(moved, other);
+    CHECK(migrated.size() == moved.size());
+    for(size_t i = 0; i < moved.size(); ++i) {
+        const auto from = moved[i], to = migrated[i];
+        CHECK(world.getComponentMask(from) == 0);
+        CHECK(other.isValid(to) && other.hasComponents<CName>(to));
+        CHECK(other.getComponent<CName>(to).value == reference->getComponent<CName>(from).value);
+        CHECK(other.getComponent<CPosition>(to).x == reference->getComponent<CPosition>(from).x);
+        CHECK(other.hasComponents<CRadius>(to) == reference->hasComponents<CRadius>(from));
+    }
+
+    // and back, queued from a parallel system
+    other.tickSystem<const CName>(false, true, [&](ecs::EntityHandle entity, const CName&) {
+        other.queueMigration(entity.getId(), world);
+    });
+    const auto returned = other.migrateQueued();
+    CHECK(returned.size() == moved.size());
+    for(const auto& migration : returned) {
+        CHECK(migration.world == &world && !other.hasComponents<CName>(migration.from));
+        const auto& name = world.getComponent<CName>(migration.to).value;
+        const auto original = ecs::EntityId(std::stoul(name.substr(7)));
+        CHECK(world.getComponent<CPosition>(migration.to).y == reference->getComponent<CPosition>(original).y);
+    }
+    size_t named = 0;
+    world.tickSystem<const CName>(false, false, [&named](const CName&) { named++; });
+    CHECK(named == moved.size());
+}
+
+void testWorkerPool() {
+    // every index exactly once, in chunks that start at multiples of the chunk size (they decide the NUMA node)
+    for(const size_t workers : {1, 4}) {
+        for(const bool numaAware : {false, true}) {
+            ecs::WorkerPool pool(workers, numaAware);
+            const size_t count = ecs::WorkerPool::CHUNK_SIZE * 10 + 17;
+            std::vector<std::atomic<int>> visits(count);
+            std::atomic<bool> aligned = true;
+            pool.parallelFor(count, [&](size_t begin, size_t end) {
+                if(begin % ecs::WorkerPool::CHUNK_SIZE != 0 || (end != count && end - begin != ecs::WorkerPool::CHUNK_SIZE)) {
+                    aligned = false;
+                }
+                for(auto i = begin; i < end; ++i) visits[i]++;
+            });
+            CHECK(aligned);
+            CHECK(std::all_of(visits.begin(), visits.end(), [](const std::atomic<int>& v) { return v == 1; }));
+        }
+    }
+
+    ecs::ThreadConfig config;
+    config.workerCount = 2;
+    config.workerAffinity = {{0}};
+    CHECK(ecs::WorkerPool(config).getUnpinnedWorkerCount() == 0);
+    config.workerAffinity = {{0}, {100000}}; // no such CPU
+    CHECK(ecs::WorkerPool(config).getUnpinnedWorkerCount() == 1);
+}
+
+} // namespace
+
+// neither of them in the anonymous namespace, so the system has external linkage and dladdr finds its name (the
+// executable is linked with ENABLE_EXPORTS)
+struct CAge {
+    int frames;
+};
+
+void worldtestAge(CAge& age) {
+    age.frames++;
+}
+
+namespace {
+
+void testSystemNames() {
+    ecs::World world;
+    world.setProfiler(std::make_shared<ecs::SystemProfiler>());
+    world.createEntity().add<CAge>(CAge{0});
+    world.flush();
+    world.tickSystem<CAge>(false, false, worldtestAge);
+    const auto profiles = world.getProfiler()->getProfiles();
+    CHECK(profiles.size() == 1 && profiles[0].name == "worldtestAge(CAge&)");
+}
+
+int newHandlerCalls = 0;
+
+void testNewHandler() {
+    // also with ECS_TRACK_ALLOCATIONS, which replaces operator new: the handler is called until it gives up
+    std::set_new_handler([]() {
+        if(++newHandlerCalls == 3) std::set_new_handler(nullptr);
+    });
+    volatile auto size = std::numeric_limits<size_t>::max() / 2;
+    bool thrown = false;
+    try {
+        ::operator delete(::operator new(size));
+    } catch(const std::bad_alloc&) {
+        thrown = true;
+    }
+    CHECK(thrown && newHandlerCalls == 3);
+    CHECK(::operator new(size, std::nothrow) == nullptr);
+}
+
+} // namespace
+
+int main() {
+    testForEachPair();
+    testReduce();
+    testCorruptRegions();
+    testSerialization();
+    testModifiedTicks();
+    testSystemHandles();
+    testCoroutineWindows();
+    testFork();
+    testForEachChunk();
+    testCompression();
+    testBlockReclamation();
+    testMigration();
+    testWorkerPool();
+    testSystemNames();
+    testNewHandler();
+
+    std::printf("%s\n", failures == 0 ? "ok" : "failed");
+    return failures == 0 ? 0 : 1;
+}